@@ -0,0 +1,154 @@
+// Tab completion latency.
+//
+// A scratch directory gets a PATH directory of N executables and a plain
+// directory of M files. For each, the first Tab finds nothing read yet; the
+// idle slices that read it are timed one by one, since each is how long a
+// key could wait behind them, and then the total. After that every Tab is
+// answered from the trie or the listing cache, and those are timed for a
+// spread of prefixes.
+//
+// usage: bench/complete_bench [commands] [files]
+
+#define _DEFAULT_SOURCE
+
+#include "../include/complete.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TABS 2000
+
+// complete.c lists the builtins too; the bench has none
+const char *builtin_name(int idx) {
+    (void) idx ;
+    return NULL ;
+}
+
+static double now_sec(void) {
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return ts.tv_sec + ts.tv_nsec / 1e9 ;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b ;
+    return (x > y) - (x < y) ;
+}
+
+static void report(const char *name, double *lat, int n) {
+    qsort(lat, n, sizeof(double), cmp_double) ;
+    printf("%-12s p50 %9.1f us   p99 %9.1f us   max %9.1f us\n",
+           name, lat[n / 2], lat[n * 99 / 100], lat[n - 1]) ;
+}
+
+static void populate(const char *dir, const char *stem, int n, mode_t mode) {
+    char path[512] ;
+    mkdir(dir, 0755) ;
+    for(int i = 0 ; i < n ; i++) {
+        snprintf(path, sizeof(path), "%s/%s%d", dir, stem, i) ;
+        int fd = open(path, O_CREAT | O_WRONLY, mode) ;
+        if(fd < 0) {
+            perror(path) ;
+            exit(1) ;
+        }
+        close(fd) ;
+    }
+}
+
+static void clean(const char *dir, const char *stem, int n) {
+    char path[512] ;
+    for(int i = 0 ; i < n ; i++) {
+        snprintf(path, sizeof(path), "%s/%s%d", dir, stem, i) ;
+        unlink(path) ;
+    }
+    rmdir(dir) ;
+}
+
+// The first Tab on line, then idle slices until it can be answered.
+static void first_tab(const char *name, const char *line, int expect) {
+    completion c ;
+    double *slice = NULL, t0 = now_sec() ;
+    int n = 0, cap = 0 ;
+
+    if(complete_word(line, strlen(line), &c) == 0) {
+        fprintf(stderr, "%s: answered before anything was read\n", name) ;
+        exit(1) ;
+    }
+    for(;;) {
+        double t = now_sec() ;
+        int more = complete_idle() ;
+        if(n == cap) {
+            cap = cap ? cap * 2 : 256 ;
+            slice = realloc(slice, cap * sizeof(*slice)) ;
+            if(!slice) exit(1) ;
+        }
+        slice[n++] = (now_sec() - t) * 1e6 ;
+        if(!more) break ;
+    }
+    double total = now_sec() - t0 ;
+    if(complete_word(line, strlen(line), &c) < 0 || (int) c.n != expect) {
+        fprintf(stderr, "%s: %zu matches, expected %d\n", name, c.n, expect) ;
+        exit(1) ;
+    }
+    complete_free(&c) ;
+    report(name, slice, n) ;
+    printf("%-12s read in %d slices, %.1f ms\n", "", n, total * 1e3) ;
+    free(slice) ;
+}
+
+// Tabs on prefix<k> for a spread of k, all answered from what was read.
+static void later_tabs(const char *name, const char *prefix, int n) {
+    static double lat[TABS] ;
+    char line[512] ;
+    completion c ;
+
+    for(int i = 0 ; i < TABS ; i++) {
+        snprintf(line, sizeof(line), "%s%d", prefix, (int) ((long) i * 7919 % (n > 10 ? n / 10 : 1))) ;
+        double t = now_sec() ;
+        int got = complete_word(line, strlen(line), &c) ;
+        lat[i] = (now_sec() - t) * 1e6 ;
+        if(got < 0 || c.n == 0) {
+            fprintf(stderr, "%s: no match for %s\n", name, line) ;
+            exit(1) ;
+        }
+        complete_free(&c) ;
+    }
+    report(name, lat, TABS) ;
+}
+
+int main(int argc, char **argv) {
+    int cmds = argc > 1 ? atoi(argv[1]) : 5000 ;
+    int files = argc > 2 ? atoi(argv[2]) : 100000 ;
+    char root[] = "/tmp/psh-complete-XXXXXX", bin[512], dir[512], line[600] ;
+
+    if(cmds < 1) cmds = 1 ;
+    if(files < 1) files = 1 ;
+    if(!mkdtemp(root)) {
+        perror("mkdtemp") ;
+        return 1 ;
+    }
+    snprintf(bin, sizeof(bin), "%s/bin", root) ;
+    snprintf(dir, sizeof(dir), "%s/files", root) ;
+    populate(bin, "zcmd", cmds, 0755) ;
+    populate(dir, "file", files, 0644) ;
+    setenv("PATH", bin, 1) ;
+    printf("%d commands, %d files\n", cmds, files) ;
+
+    first_tab("commands", "zcmd", cmds) ;
+    later_tabs("command tab", "zcmd", cmds) ;
+
+    snprintf(line, sizeof(line), "ls %s/file", dir) ;
+    first_tab("files", line, files) ;
+    snprintf(line, sizeof(line), "ls %s/file", dir) ;
+    later_tabs("file tab", line, files) ;
+
+    clean(bin, "zcmd", cmds) ;
+    clean(dir, "file", files) ;
+    rmdir(root) ;
+    return 0 ;
+}
@@ -0,0 +1,200 @@
+// Line editor latency and paste throughput.
+//
+// psh is started on a pty with a scratch $HOME. The "key" row types one
+// character at a time and times each until its echo is read back, entering
+// the line every 64 characters. The "paste" rows write a line of N
+// bytes in one go, as a terminal does for a paste, and time it until the
+// marker at its end is echoed; throughput is input bytes over that time.
+// The "script" rows paste a script of N echo lines inside bracketed paste
+// markers and time it until the whole script is on the line, before
+// anything runs.
+//
+// usage: bench/edit_bench [keys] [paste bytes] [script lines] [path to psh]
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PASTE_RUNS 10
+
+static double now_sec(void) {
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return ts.tv_sec + ts.tv_nsec / 1e9 ;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b ;
+    return (x > y) - (x < y) ;
+}
+
+static void report(const char *name, double *lat, int n) {
+    qsort(lat, n, sizeof(double), cmp_double) ;
+    printf("%-10s p50 %9.1f us   p99 %9.1f us   max %9.1f us\n",
+           name, lat[n / 2], lat[n * 99 / 100], lat[n - 1]) ;
+}
+
+static int master = -1 ;
+static pid_t child ;
+
+static void spawn(const char *psh) {
+    master = posix_openpt(O_RDWR | O_NOCTTY) ;
+    if(master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt") ;
+        exit(1) ;
+    }
+    const char *slave = ptsname(master) ;
+
+    child = fork() ;
+    if(child == 0) {
+        setsid() ;
+        int fd = open(slave, O_RDWR) ;
+        if(fd < 0) _exit(127) ;
+        dup2(fd, 0) ;
+        dup2(fd, 1) ;
+        dup2(fd, 2) ;
+        if(fd > 2) close(fd) ;
+        close(master) ;
+        execl(psh, psh, (char *) NULL) ;
+        _exit(127) ;
+    }
+    fcntl(master, F_SETFL, O_NONBLOCK) ;
+}
+
+static char out[65536] ;
+static size_t out_pos, out_len ;     // read but not yet matched
+
+// Writes len bytes of in while reading the output, until all of it is sent
+// and tail has been read. Returns the seconds that took, or -1 on a timeout.
+static double exchange(const char *in, size_t len, const char *tail) {
+    size_t sent = 0, tlen = strlen(tail), seen = 0 ;
+    double t0 = now_sec() ;
+
+    for(;;) {
+        // match tail across reads
+        for( ; out_pos < out_len ; out_pos++) {
+            char c = out[out_pos] ;
+            seen = c == tail[seen] ? seen + 1 : c == tail[0] ;
+            if(seen == tlen && sent == len) {
+                out_pos++ ;
+                return now_sec() - t0 ;
+            }
+            if(seen == tlen) seen = 0 ;
+        }
+
+        struct pollfd pfd = { master, POLLIN | (sent < len ? POLLOUT : 0), 0 } ;
+        if(poll(&pfd, 1, 5000) <= 0) return -1 ;
+        if((pfd.revents & POLLOUT) && sent < len) {
+            ssize_t w = write(master, in + sent, len - sent) ;
+            if(w > 0) sent += w ;
+        }
+        if(!(pfd.revents & POLLIN)) continue ;
+        ssize_t n = read(master, out, sizeof(out)) ;
+        if(n < 0 && (errno == EINTR || errno == EAGAIN)) continue ;
+        if(n <= 0) return -1 ;
+        out_pos = 0 ;
+        out_len = n ;
+    }
+}
+
+// Runs the line typed so far, which is no command, and waits for the next
+// prompt so nothing of the old line is left unread. Enter rather than ^C,
+// which psh before the buffered editor could miss while it was echoing.
+static void cancel(void) {
+    if(exchange("\r", 1, "\n") < 0 || exchange("", 0, "$ ") < 0) {
+        fprintf(stderr, "no prompt after the line ran [%.*s]\n", (int) out_len, out) ;
+        exit(1) ;
+    }
+}
+
+int main(int argc, char **argv) {
+    int keys = argc > 1 ? atoi(argv[1]) : 2000 ;
+    size_t paste = argc > 2 ? (size_t) atol(argv[2]) : 65536 ;
+    int lines = argc > 3 ? atoi(argv[3]) : 500 ;
+    const char *psh = argc > 4 ? argv[4] : "./psh" ;
+
+    if(keys <= 0) keys = 1 ;
+    if(paste < 2) paste = 2 ;
+    if(lines < 0) lines = 0 ;
+    char dir[] = "/tmp/psh-edit-XXXXXX" ;
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp") ;
+        return 1 ;
+    }
+    setenv("HOME", dir, 1) ;
+    double *lat = malloc((keys > PASTE_RUNS ? keys : PASTE_RUNS) * sizeof(double)) ;
+    char *line = malloc(paste) ;
+    size_t script_cap = 32 * (size_t) lines + 64, script_len = 0 ;
+    char *script = malloc(script_cap) ;
+    if(!lat || !line || !script) return 1 ;
+
+    spawn(psh) ;
+    if(exchange("", 0, "$ ") < 0) {
+        fprintf(stderr, "%s: no prompt\n", psh) ;
+        return 1 ;
+    }
+
+    for(int i = 0 ; i < keys ; i++) {
+        char c = 'a' + i % 26 ;
+        char echo[2] = { c, '\0' } ;
+        lat[i] = exchange(&c, 1, echo) * 1e6 ;
+        if(lat[i] < 0) {
+            fprintf(stderr, "no echo\n") ;
+            return 1 ;
+        }
+        if(i % 64 == 63) cancel() ;
+    }
+    cancel() ;
+    printf("%d keystrokes\n", keys) ;
+    report("key", lat, keys) ;
+
+    memset(line, 'x', paste - 1) ;
+    line[paste - 1] = 'Z' ;
+    for(int i = 0 ; i < PASTE_RUNS ; i++) {
+        lat[i] = exchange(line, paste, "xZ") * 1e6 ;
+        if(lat[i] < 0) {
+            fprintf(stderr, "paste not echoed\n") ;
+            return 1 ;
+        }
+        cancel() ;
+    }
+    report("paste", lat, PASTE_RUNS) ;
+    printf("paste of %zu bytes at %.1f MB/s (median)\n", paste, paste / lat[PASTE_RUNS / 2]) ;
+
+    script_len += snprintf(script, script_cap, "\033[200~") ;
+    for(int i = 0 ; i < lines ; i++)
+        script_len += snprintf(script + script_len, script_cap - script_len, "echo line %d\r", i) ;
+    script_len += snprintf(script + script_len, script_cap - script_len, "echo end-of-script\033[201~") ;
+    for(int i = 0 ; i < PASTE_RUNS ; i++) {
+        lat[i] = exchange(script, script_len, "end-of-script") * 1e6 ;
+        if(lat[i] < 0) {
+            fprintf(stderr, "script not echoed\n") ;
+            return 1 ;
+        }
+        cancel() ;
+    }
+    report("script", lat, PASTE_RUNS) ;
+    printf("script of %d lines (%zu bytes) on the line in %.2f ms (median)\n",
+           lines + 1, script_len, lat[PASTE_RUNS / 2] / 1e3) ;
+
+    kill(child, SIGKILL) ;
+    waitpid(child, NULL, 0) ;
+    close(master) ;
+    char path[256] ;
+    snprintf(path, sizeof(path), "%s/.Psh_history", dir) ;
+    unlink(path) ;
+    rmdir(dir) ;
+    free(lat) ;
+    free(line) ;
+    free(script) ;
+    return 0 ;
+}
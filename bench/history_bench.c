@@ -0,0 +1,93 @@
+// Prompt latency added by history persistence.
+//
+// A history file of N lines is created in a scratch $HOME and loaded. Each
+// round is then what psh does between two prompts: history_add_if_needed()
+// of a new command. The same rounds are run against a full rewrite of the
+// file, which is what history_save() used to do on every command.
+//
+// usage: bench/history_bench [lines] [rounds]
+
+#include "../include/posix_lib.h"
+#include "../include/history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_sec(void) {
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return ts.tv_sec + ts.tv_nsec / 1e9 ;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b ;
+    return (x > y) - (x < y) ;
+}
+
+static void report(const char *name, double *lat, int n) {
+    double sum = 0 ;
+    for(int i = 0 ; i < n ; i++) sum += lat[i] ;
+    qsort(lat, n, sizeof(double), cmp_double) ;
+    printf("%-10s mean %9.1f us   p50 %9.1f us   p99 %9.1f us   max %9.1f us\n",
+           name, sum / n, lat[n / 2], lat[n * 99 / 100], lat[n - 1]) ;
+}
+
+static void write_history(const char *path, int lines) {
+    FILE *f = fopen(path, "w") ;
+    if(!f) {
+        perror(path) ;
+        exit(1) ;
+    }
+    for(int i = 0 ; i < lines ; i++) fprintf(f, "make -C build/%d -j8 target_%d\n", i % 97, i) ;
+    fclose(f) ;
+}
+
+static shell_state st ;
+
+int main(int argc, char **argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 100000 ;
+    int rounds = argc > 2 ? atoi(argv[2]) : 30000 ;
+    int rewrites = rounds < 200 ? rounds : 200 ;
+
+    char dir[] = "/tmp/psh-history-XXXXXX" ;
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp") ;
+        return 1 ;
+    }
+    char path[256] ;
+    snprintf(path, sizeof(path), "%s/.Psh_history", dir) ;
+    setenv("HOME", dir, 1) ;
+    write_history(path, lines) ;
+
+    double *lat = malloc(rounds * sizeof(double)) ;
+    if(!lat) return 1 ;
+    char cmd[64] ;
+
+    history_load(&st) ;
+    for(int i = 0 ; i < rounds ; i++) {
+        snprintf(cmd, sizeof(cmd), "grep -rn pattern_%d src", i) ;
+        double t = now_sec() ;
+        history_add_if_needed(&st, cmd) ;
+        lat[i] = (now_sec() - t) * 1e6 ;
+    }
+    history_sync() ;
+    printf("%d-line history, %d commands\n", lines, rounds) ;
+    report("append", lat, rounds) ;
+
+    // the old writer: truncate and write every line again
+    write_history(path, lines) ;
+    for(int i = 0 ; i < rewrites ; i++) {
+        double t = now_sec() ;
+        write_history(path, lines) ;
+        lat[i] = (now_sec() - t) * 1e6 ;
+    }
+    report("rewrite", lat, rewrites) ;
+
+    unlink(path) ;
+    rmdir(dir) ;
+    free(lat) ;
+    return 0 ;
+}
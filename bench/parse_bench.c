@@ -0,0 +1,79 @@
+// Lines parsed per second by parse_line() over a corpus of command lines,
+// and the largest arena footprint per source byte seen on any line.
+//
+// usage: bench/parse_bench [corpus] [rounds]
+
+#include "../include/parser.h"
+#include "../include/arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_sec(void) {
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return ts.tv_sec + ts.tv_nsec / 1e9 ;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "bench/corpus.txt" ;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20000 ;
+
+    FILE *f = fopen(path, "r") ;
+    if(!f) {
+        perror(path) ;
+        return 1 ;
+    }
+
+    char **lines = NULL ;
+    int n = 0, cap = 0 ;
+    size_t bytes = 0 ;
+    char *line = NULL ;
+    size_t lcap = 0 ;
+    ssize_t len ;
+
+    while((len = getline(&line, &lcap, f)) > 0) {
+        if(line[len - 1] == '\n') line[--len] = '\0' ;
+        if(n == cap) {
+            cap = cap ? cap * 2 : 64 ;
+            lines = realloc(lines, cap * sizeof(char *)) ;
+        }
+        lines[n++] = strdup(line) ;
+        bytes += len ;
+    }
+    free(line) ;
+    fclose(f) ;
+
+    arena a = {0} ;
+    double worst = 0 ;
+
+    for(int i = 0 ; i < n ; i++) {
+        a.peak = 0 ;
+        if(!parse_line(&a, lines[i])) fprintf(stderr, "syntax error: %s\n", lines[i]) ;
+        double per_byte = (double)a.peak / (strlen(lines[i]) + 1) ;
+        if(per_byte > worst) worst = per_byte ;
+        arena_reset(&a) ;
+    }
+
+    double t0 = now_sec() ;
+    for(int r = 0 ; r < rounds ; r++) {
+        for(int i = 0 ; i < n ; i++) {
+            parse_line(&a, lines[i]) ;
+            arena_reset(&a) ;
+        }
+    }
+    double dt = now_sec() - t0 ;
+
+    double total = (double)rounds * n ;
+    printf("%d lines x %d rounds: %.0f lines/s, %.1f MB/s\n",
+           n, rounds, total / dt, rounds * (double)bytes / dt / 1e6) ;
+    printf("peak arena use: %.1f bytes per source byte\n", worst) ;
+
+    arena_release(&a) ;
+
+    for(int i = 0 ; i < n ; i++) free(lines[i]) ;
+    free(lines) ;
+    return 0 ;
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Throughput of an N-stage `cat` pipeline run by psh, in GB/s.
+#
+#   bench/pipe_bench.sh [stages] [MiB]
+#
+# Each configuration streams the same file through the pipeline and times the
+# whole run, so the figure includes psh's launch cost (a few ms).
+
+PSH=${PSH:-./psh}
+STAGES=${1:-4}
+MIB=${2:-1024}
+DATA=$(mktemp)
+trap 'rm -f "$DATA"' EXIT
+
+head -c "$((MIB * 1048576))" /dev/zero > "$DATA"
+
+chain="cat < $DATA"
+i=1
+while [ "$i" -lt "$STAGES" ]; do
+    chain="$chain | cat"
+    i=$((i + 1))
+done
+chain="$chain > /dev/null"
+
+run() {
+    label=$1
+    shift
+    start=$(date +%s.%N)
+    printf '%s\n' "$@" "$chain" exit | "$PSH" > /dev/null 2>&1
+    end=$(date +%s.%N)
+    echo "$label $start $end" | awk -v mib="$MIB" \
+        '{ printf "%-24s %6.2f GB/s\n", $1, mib * 1048576 / ($3 - $2) / 1e9 }'
+}
+
+echo "$STAGES stages, $MIB MiB"
+run default          "set"
+run pipesize=1M      "set pipesize=1M"
+run splice           "set -o splice"
+run splice+pipesize  "set -o splice" "set pipesize=1M"
@@ -0,0 +1,145 @@
+// Time to the first interactive prompt, against the size of the history.
+//
+// psh is started on a pty with a scratch $HOME, once with no history and
+// once with an N-line ~/.Psh_history, and timed from spawn until its prompt
+// shows up. Both should take the same time; history_load() only maps the
+// file. For comparison, the "fgets" row is the old loader's work on the
+// same file: read every line and copy it before the prompt.
+//
+// usage: bench/prompt_bench [lines] [runs] [path to psh]
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static double now_sec(void) {
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return ts.tv_sec + ts.tv_nsec / 1e9 ;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b ;
+    return (x > y) - (x < y) ;
+}
+
+static void report(const char *name, double *lat, int n) {
+    qsort(lat, n, sizeof(double), cmp_double) ;
+    printf("%-10s p50 %9.1f us   p99 %9.1f us   max %9.1f us\n",
+           name, lat[n / 2], lat[n * 99 / 100], lat[n - 1]) ;
+}
+
+static void write_history(const char *path, int lines) {
+    FILE *f = fopen(path, "w") ;
+    if(!f) {
+        perror(path) ;
+        exit(1) ;
+    }
+    for(int i = 0 ; i < lines ; i++) fprintf(f, "make -C build/%d -j8 target_%d\n", i % 97, i) ;
+    fclose(f) ;
+}
+
+// Spawns psh on a fresh pty and returns the microseconds until "$ " is read.
+static double time_prompt(const char *psh) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY) ;
+    if(master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt") ;
+        exit(1) ;
+    }
+    const char *slave = ptsname(master) ;
+
+    double t0 = now_sec() ;
+    pid_t pid = fork() ;
+    if(pid == 0) {
+        setsid() ;
+        int fd = open(slave, O_RDWR) ;
+        if(fd < 0) _exit(127) ;
+        dup2(fd, 0) ;
+        dup2(fd, 1) ;
+        dup2(fd, 2) ;
+        if(fd > 2) close(fd) ;
+        close(master) ;
+        execl(psh, psh, (char *) NULL) ;
+        _exit(127) ;
+    }
+
+    char buf[4096], prev = 0 ;
+    double lat = -1 ;
+    struct pollfd pfd = { master, POLLIN, 0 } ;
+    while(lat < 0 && poll(&pfd, 1, 5000) > 0) {
+        ssize_t n = read(master, buf, sizeof(buf)) ;
+        if(n <= 0 && errno != EINTR) break ;
+        for(ssize_t i = 0 ; i < n ; i++) {
+            if(prev == '$' && buf[i] == ' ') lat = (now_sec() - t0) * 1e6 ;
+            prev = buf[i] ;
+        }
+    }
+    kill(pid, SIGKILL) ;
+    waitpid(pid, NULL, 0) ;
+    close(master) ;
+    if(lat < 0) {
+        fprintf(stderr, "%s: no prompt\n", psh) ;
+        exit(1) ;
+    }
+    return lat ;
+}
+
+static double time_fgets(const char *path) {
+    double t = now_sec() ;
+    FILE *f = fopen(path, "r") ;
+    char line[4096] ;
+    size_t kept = 0 ;
+
+    if(!f) return 0 ;
+    while(fgets(line, sizeof(line), f)) {
+        char *copy = strdup(line) ;
+        kept += copy != NULL ;
+        free(copy) ;
+    }
+    fclose(f) ;
+    return kept ? (now_sec() - t) * 1e6 : 0 ;
+}
+
+int main(int argc, char **argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 1000000 ;
+    int runs = argc > 2 ? atoi(argv[2]) : 200 ;
+    const char *psh = argc > 3 ? argv[3] : "./psh" ;
+
+    if(runs <= 0) runs = 1 ;
+    char dir[] = "/tmp/psh-prompt-XXXXXX" ;
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp") ;
+        return 1 ;
+    }
+    char path[256] ;
+    snprintf(path, sizeof(path), "%s/.Psh_history", dir) ;
+    setenv("HOME", dir, 1) ;
+    double *lat = malloc(runs * sizeof(double)) ;
+    if(!lat) return 1 ;
+
+    printf("%d runs, %d-line history\n", runs, lines) ;
+    for(int i = 0 ; i < runs ; i++) lat[i] = time_prompt(psh) ;
+    report("empty", lat, runs) ;
+
+    write_history(path, lines) ;
+    for(int i = 0 ; i < runs ; i++) lat[i] = time_prompt(psh) ;
+    report("full", lat, runs) ;
+
+    int reads = runs < 20 ? runs : 20 ;
+    for(int i = 0 ; i < reads ; i++) lat[i] = time_fgets(path) ;
+    report("fgets", lat, reads) ;
+
+    unlink(path) ;
+    rmdir(dir) ;
+    free(lat) ;
+    return 0 ;
+}
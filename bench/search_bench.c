@@ -0,0 +1,151 @@
+// Ctrl-R latency over a large history.
+//
+// A history file of N generated commands is loaded from a scratch $HOME.
+// The first search builds the trigram index and is timed on its own. Then
+// each pattern is "typed" one character at a time, each keystroke being
+// one histsearch_find() from the current match as input.c does it, and
+// each pattern is stepped back through up to 100 older matches as repeated
+// Ctrl-R would. Last, command lines are typed the same way for the
+// autosuggestion lookup, one histsearch_suggest() per keystroke.
+//
+// usage: bench/search_bench [lines]
+
+#include "../include/posix_lib.h"
+#include "../include/history.h"
+#include "../include/histsearch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+// per keystroke
+#define TARGET_US 1000.0
+
+static double now_sec(void) {
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return ts.tv_sec + ts.tv_nsec / 1e9 ;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b ;
+    return (x > y) - (x < y) ;
+}
+
+static long max_rss_kb(void) {
+    struct rusage ru ;
+    getrusage(RUSAGE_SELF, &ru) ;
+    return ru.ru_maxrss ;
+}
+
+static double report(const char *name, double *lat, int n) {
+    qsort(lat, n, sizeof(double), cmp_double) ;
+    printf("%-10s %6d calls   p50 %8.1f us   p99 %8.1f us   max %8.1f us\n",
+           name, n, lat[n / 2], lat[n * 99 / 100], lat[n - 1]) ;
+    return lat[n - 1] ;
+}
+
+static const char *verbs[] = {
+    "make -C build/%u -j8 target_%u", "git commit -m 'fix issue %u in module %u'",
+    "ssh deploy@host-%u.example.net uptime # %u", "grep -rn pattern_%u src/%u",
+    "cd ~/work/project-%u/sub%u", "docker run --rm -it image:%u.%u",
+} ;
+
+static void write_history(const char *path, int lines) {
+    FILE *f = fopen(path, "w") ;
+    if(!f) {
+        perror(path) ;
+        exit(1) ;
+    }
+    unsigned seed = 1 ;
+    for(int i = 0 ; i < lines ; i++) {
+        seed = seed * 1103515245 + 12345 ;
+        unsigned a = (seed >> 8) % 100000, b = (seed >> 20) % 100 ;
+        fprintf(f, verbs[(seed >> 4) % 6], a, b) ;
+        fputc('\n', f) ;
+    }
+    fclose(f) ;
+}
+
+static shell_state st ;
+
+int main(int argc, char **argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 1000000 ;
+    static const char *patterns[] = {
+        "target_4242", "git commit -m 'fix issue 77", "host-31337", "image:9",
+        "docker run --rm -it image:12345.6", "no such command anywhere", "sub4",
+    } ;
+    static const char *prefixes[] = {
+        "git commit -m 'fix issue 77", "docker run --rm -it image:12345.6",
+        "ssh deploy@host-31337", "make -C build/9", "cd ~/nowhere",
+    } ;
+    int n_pat = sizeof(patterns) / sizeof(patterns[0]) ;
+    int n_pre = sizeof(prefixes) / sizeof(prefixes[0]) ;
+
+    char dir[] = "/tmp/psh-search-XXXXXX" ;
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp") ;
+        return 1 ;
+    }
+    char path[256] ;
+    snprintf(path, sizeof(path), "%s/.Psh_history", dir) ;
+    setenv("HOME", dir, 1) ;
+    setenv("HISTSIZE", "10000000", 1) ;
+    write_history(path, lines) ;
+    history_load(&st) ;
+
+    long rss = max_rss_kb() ;
+    double t = now_sec() ;
+    histsearch_find(&st, "make", 1) ;
+    printf("%d-line history, index built in %.1f ms, peak RSS +%ld KB\n",
+           lines, (now_sec() - t) * 1e3, max_rss_kb() - rss) ;
+
+    double *keys = malloc(4096 * sizeof(double)), *steps = malloc(4096 * sizeof(double)) ;
+    double *sugs = malloc(4096 * sizeof(double)) ;
+    int n_keys = 0, n_steps = 0, n_sugs = 0, n_found = 0 ;
+    char pat[128] ;
+    if(!keys || !steps || !sugs) return 1 ;
+
+    for(int p = 0 ; p < n_pat ; p++) {
+        size_t match = 0, len = strlen(patterns[p]) ;
+        for(size_t i = 1 ; i <= len ; i++) {
+            memcpy(pat, patterns[p], i) ;
+            pat[i] = '\0' ;
+            t = now_sec() ;
+            size_t m = histsearch_find(&st, pat, match ? match : 1) ;
+            keys[n_keys++] = (now_sec() - t) * 1e6 ;
+            if(m) match = m ;
+        }
+        for(int i = 0 ; i < 100 && match ; i++) {
+            t = now_sec() ;
+            match = histsearch_find(&st, patterns[p], match + 1) ;
+            steps[n_steps++] = (now_sec() - t) * 1e6 ;
+        }
+    }
+    for(int p = 0 ; p < n_pre ; p++) {
+        size_t len = strlen(prefixes[p]) ;
+        for(size_t i = 1 ; i <= len ; i++) {
+            t = now_sec() ;
+            const char *s = histsearch_suggest(&st, prefixes[p], i) ;
+            sugs[n_sugs++] = (now_sec() - t) * 1e6 ;
+            n_found += s != NULL ;
+        }
+    }
+    double worst = report("keystroke", keys, n_keys) ;
+    report("ctrl-r", steps, n_steps) ;
+    double worst_sug = report("suggest", sugs, n_sugs) ;
+    printf("%d of %d keystrokes had a suggestion\n", n_found, n_sugs) ;
+    if(worst_sug > worst) worst = worst_sug ;
+    printf("worst keystroke %.1f us (target < %.0f us) %s\n",
+           worst, TARGET_US, worst < TARGET_US ? "ok" : "MISSED") ;
+
+    unlink(path) ;
+    rmdir(dir) ;
+    free(keys) ;
+    free(steps) ;
+    free(sugs) ;
+    return worst < TARGET_US ? 0 : 1 ;
+}
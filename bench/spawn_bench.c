@@ -0,0 +1,66 @@
+// Spawns per second through launch_fork() vs launch_spawn().
+//
+// A long-running shell carries a large heap, so the process first dirties
+// heap_mb megabytes to make fork() pay for copying the page tables.
+//
+// usage: bench/spawn_bench [iterations] [heap_mb]
+
+#include "../include/posix_lib.h"
+#include "../include/launch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+typedef pid_t (*launch_fn)(const launch_spec *) ;
+
+static double now_sec(void) {
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return ts.tv_sec + ts.tv_nsec / 1e9 ;
+}
+
+static double run(const char *name, launch_fn fn, int iters) {
+    char *argv[] = { "true", NULL } ;
+    launch_spec ls = {
+        .argv = argv,
+        .in_fd = STDIN_FILENO, .out_fd = STDOUT_FILENO,
+        .wait_fg = 1, .pg_lead = -1,
+    } ;
+
+    double t0 = now_sec() ;
+    for(int i = 0 ; i < iters ; i++) {
+        pid_t pid = fn(&ls) ;
+        if(pid < 0) {
+            fprintf(stderr, "%s: launch failed\n", name) ;
+            exit(1) ;
+        }
+        waitpid(pid, NULL, 0) ;
+    }
+    double rate = iters / (now_sec() - t0) ;
+    printf("%-8s %10.0f spawns/s\n", name, rate) ;
+    return rate ;
+}
+
+int main(int argc, char **argv) {
+    int iters = argc > 1 ? atoi(argv[1]) : 2000 ;
+    size_t heap_mb = argc > 2 ? (size_t)atol(argv[2]) : 256 ;
+
+    char *heap = malloc(heap_mb << 20) ;
+    if(heap_mb && !heap) {
+        perror("malloc") ;
+        return 1 ;
+    }
+    memset(heap, 1, heap_mb << 20) ;
+
+    printf("%d spawns of true, %zu MiB resident heap\n", iters, heap_mb) ;
+    double f = run("fork", launch_fork, iters) ;
+    double s = run("spawn", launch_spawn, iters) ;
+    printf("speedup  %10.2fx\n", s / f) ;
+
+    free(heap) ;
+    return 0 ;
+}
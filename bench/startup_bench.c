@@ -0,0 +1,89 @@
+// Startup latency of `psh -c true`, the cost of every system() or CI step
+// that goes through psh.
+//
+// Each run is spawned and reaped from here. Running `true` directly gives
+// the floor, so psh's own overhead up to its first exec is the difference.
+// /bin/sh is measured the same way for reference.
+//
+// usage: bench/startup_bench [iterations] [path to psh]
+
+#include "../include/posix_lib.h"
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// time to the first exec, per invocation, on a warm cache
+#define TARGET_US 1000.0
+
+extern char **environ ;
+
+static double now_sec(void) {
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return ts.tv_sec + ts.tv_nsec / 1e9 ;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b ;
+    return (x > y) - (x < y) ;
+}
+
+// Returns the median latency in microseconds.
+static double run(const char *name, char **argv, int iters, double *lat) {
+    double t0 = now_sec() ;
+
+    for(int i = 0 ; i < iters ; i++) {
+        double s = now_sec() ;
+        pid_t pid ;
+        int status ;
+
+        if(posix_spawn(&pid, argv[0], NULL, NULL, argv, environ)) {
+            fprintf(stderr, "%s: spawn failed\n", argv[0]) ;
+            exit(1) ;
+        }
+        waitpid(pid, &status, 0) ;
+        if(!WIFEXITED(status) || WEXITSTATUS(status)) {
+            fprintf(stderr, "%s: exited with status %d\n", name, status) ;
+            exit(1) ;
+        }
+        lat[i] = (now_sec() - s) * 1e6 ;
+    }
+    double total = now_sec() - t0 ;
+
+    qsort(lat, iters, sizeof(double), cmp_double) ;
+    double p50 = lat[iters / 2] ;
+    printf("%-12s %8.0f runs/s   p50 %7.1f us   p99 %7.1f us\n",
+           name, iters / total, p50, lat[iters * 99 / 100]) ;
+    return p50 ;
+}
+
+int main(int argc, char **argv) {
+    int iters = argc > 1 ? atoi(argv[1]) : 10000 ;
+    char *psh = argc > 2 ? argv[2] : "./psh" ;
+
+    if(iters <= 0) iters = 1 ;
+    double *lat = malloc(iters * sizeof(double)) ;
+    if(!lat) {
+        perror("malloc") ;
+        return 1 ;
+    }
+
+    char *direct[] = { "/bin/true", NULL } ;
+    char *sh[] = { "/bin/sh", "-c", "/bin/true", NULL } ;
+    char *ps[] = { psh, "-c", "/bin/true", NULL } ;
+
+    printf("%d runs each\n", iters) ;
+    double floor_us = run("true", direct, iters, lat) ;
+    run("sh -c true", sh, iters, lat) ;
+    double psh_us = run("psh -c true", ps, iters, lat) ;
+
+    double over = psh_us - floor_us ;
+    printf("psh overhead to first exec: %.1f us (target < %.0f us) %s\n",
+           over, TARGET_US, over < TARGET_US ? "ok" : "MISSED") ;
+    free(lat) ;
+    return over < TARGET_US ? 0 : 1 ;
+}
@@ -0,0 +1,22 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena_chunk arena_chunk;
+
+// Bump allocator for everything built while handling one input line.
+// Nothing is freed individually; arena_reset() drops it all at once.
+typedef struct {
+    arena_chunk *head;
+    size_t used;        // bytes handed out since the last reset
+    size_t peak;        // high-water mark of used across resets
+} arena;
+
+void *arena_alloc(arena *a, size_t n) ;
+void *arena_realloc(arena *a, void *p, size_t old_n, size_t new_n) ;
+char *arena_strndup(arena *a, const char *s, size_t n) ;
+void arena_reset(arena *a) ;
+void arena_release(arena *a) ;
+
+#endif
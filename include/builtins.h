@@ -8,5 +8,11 @@ int command_env(char **env);
 int command_which(char **args, char **env);
 int command_setenv(char **args);
 int command_unsetenv(char **args);
+int command_set(char **args);
+int command_exit(char **args);
+
+int builtin_find(const char *name);
+const char *builtin_name(int idx);
+int builtin_run(int idx, char **args);
 
 #endif
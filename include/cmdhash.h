@@ -0,0 +1,10 @@
+#ifndef CMDHASH_H
+#define CMDHASH_H
+
+const char *cmdhash_lookup(const char *name) ;
+void cmdhash_reset(void) ;
+unsigned cmdhash_generation(void) ;
+const char *cmdhash_dir(int i) ;
+int command_hash(char **args) ;
+
+#endif
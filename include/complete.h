@@ -0,0 +1,24 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stddef.h>
+
+#define COMPLETE_LIST_MAX 256
+
+typedef struct {
+    char *insert;       // to insert at the cursor, NULL if nothing
+    char **list;        // the first COMPLETE_LIST_MAX matches, sorted
+    size_t n_list;
+    size_t n;           // matches in all
+    size_t common;      // bytes every match shares
+} completion;
+
+// Reads a slice of whatever a completion is waiting for; returns 1 while
+// there is more to do.
+int complete_idle(void) ;
+// Completes the word that ends at cur. Returns 0, or -1 if what it needs
+// is still being read, which complete_idle() will then finish.
+int complete_word(const char *line, size_t cur, completion *c) ;
+void complete_free(completion *c) ;
+
+#endif
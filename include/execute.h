@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <sys/types.h>
 
-int execute_command(char *line, int wait_fg, pid_t *first_pid) ;
+#include "parser.h"
 
-#endif  
\ No newline at end of file
+int execute_pipeline(pipeline *pl, int wait_fg, pid_t *first_pid) ;
+
+#endif  
@@ -10,5 +10,7 @@ size_t my_strncmp(const char* str1, const char* str2, size_t n) ;
 char* my_strcpy(char* dest, const char* src) ;  
 int my_strcmp(const char* str1, const char* str2) ;
 char* my_strncpy(char* dest, const char* src, size_t n) ;
+long long parse_size(const char* str) ;
+int wait_status_code(int status) ;
 
 #endif
\ No newline at end of file
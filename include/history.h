@@ -4,8 +4,13 @@
 #include "./shell.h" 
 
 void history_add_if_needed(shell_state *st, const char *cmd) ;
-void history_save(shell_state *st) ;
+void history_sync(void) ;
+int history_sync_due(void) ;
 void history_load(shell_state *st) ;
+void history_refresh(shell_state *st) ;
+size_t history_count(shell_state *st) ;
+// back = 1 is the newest entry; NULL past either end
+const char *history_get(shell_state *st, size_t back) ;
 
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef HISTSEARCH_H
+#define HISTSEARCH_H
+
+#include <stddef.h>
+
+#include "shell.h"
+
+// Builds a slice of the index; returns 1 while there is more to do.
+int histsearch_idle(shell_state *st) ;
+void histsearch_add(const char *text) ;
+// back number (1 = newest) of the newest entry at or before from that
+// contains pat, 0 if there is none
+size_t histsearch_find(shell_state *st, const char *pat, size_t from) ;
+// The newest entry that starts with the n bytes at prefix and goes on past
+// them; NULL if there is none or the index is still being built.
+const char *histsearch_suggest(shell_state *st, const char *prefix, size_t n) ;
+
+#endif
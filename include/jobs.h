@@ -1,10 +1,28 @@
 #ifndef JOBS_H
 #define JOBS_H 
 
+#include <sys/resource.h>
+
 #include "./shell.h"
 
-int jobs_add(shell_state *st, pid_t pid, char *cmd) ;
+job *jobs_add(shell_state *st, pid_t pgid, const pid_t *pids, int n, const char *cmd, job_state state) ;
+job *jobs_by_pid(shell_state *st, pid_t pid) ;
+job *jobs_by_pgid(shell_state *st, pid_t pgid) ;
+void jobs_remove(shell_state *st, job *j) ;
+void jobs_signal(job *j, int sig) ;
+void jobs_kill_all(shell_state *st) ;
+void jobs_close_limits(shell_state *st) ;
+job *jobs_reap(shell_state *st, pid_t pid, int status, const struct rusage *ru) ;
+pid_t jobs_wait(shell_state *st, pid_t which, int *status, int options, job **jp) ;
+void jobs_finish(shell_state *st, job *j) ;
+int jobs_status(const job *j) ;
 void jobs_check(shell_state *st) ;
 void jobs_init(shell_state *st) ;
 
-#endif 
\ No newline at end of file
+int command_jobs(char **args) ;
+int command_fg(char **args) ;
+int command_bg(char **args) ;
+int command_wait(char **args) ;
+int command_kill(char **args) ;
+
+#endif 
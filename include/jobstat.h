@@ -0,0 +1,14 @@
+#ifndef JOBSTAT_H
+#define JOBSTAT_H
+
+#include <sys/resource.h>
+
+#include "shell.h"
+
+void jobstat_exited(job_proc *p, const struct rusage *ru) ;
+void jobstat_read_io(pid_t pid, job_usage *u) ;
+void jobstat_sample(shell_state *st) ;
+void jobstat_total(const job *j, job_usage *u) ;
+const char *jobstat_size(char *buf, size_t n, unsigned long long bytes) ;
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#define LAUNCH_MAX_RLIMITS 3
+
+// Applied by the child before exec: join a cgroup through its open
+// cgroup.procs, or else set the given rlimits.
+typedef struct {
+    int cgroup_fd;
+    int n_rlimits;
+    int resource[LAUNCH_MAX_RLIMITS];
+    struct rlimit rlim[LAUNCH_MAX_RLIMITS];
+} launch_limits;
+
+typedef struct {
+    const char *path;
+    char **argv;
+    int (*builtin)(int idx, char **argv);
+    int builtin_idx;
+    char **infiles;
+    int n_in;
+    char **outfiles;
+    int *append;
+    int n_out;
+    int in_fd;
+    int out_fd;
+    int wait_fg;
+    int bg_detach_stdin;
+    pid_t pg_lead;
+    const launch_limits *limits;    // NULL for none
+} launch_spec;
+
+pid_t launch_fork(const launch_spec *ls) ;
+pid_t launch_spawn(const launch_spec *ls) ;
+pid_t launch_process(const launch_spec *ls) ;
+
+#endif
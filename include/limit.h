@@ -0,0 +1,13 @@
+#ifndef LIMIT_H
+#define LIMIT_H
+
+#include "launch.h"
+
+// The limits of one `limit ... -- pipeline`, see limit.c.
+typedef struct limit_group limit_group ;
+
+limit_group *limit_open(char **specs, int n) ;
+const launch_limits *limit_launch(const limit_group *lg) ;
+void limit_close(limit_group *lg, const char *name) ;
+
+#endif
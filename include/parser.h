@@ -4,6 +4,51 @@
 #include <stddef.h>
 #include <stdbool.h>
 
-bool parse_shell_cmd(const char *s);
+#include "arena.h"
+
+// A cooked word keeps '$' of a pending expansion as one of these markers:
+// VAR_MARK outside quotes (result is field-split), VAR_MARK_Q inside "...".
+#define VAR_MARK   '\001'
+#define VAR_MARK_Q '\002'
+
+typedef enum { REDIR_IN, REDIR_OUT, REDIR_APPEND } redir_type;
+
+typedef struct {
+    redir_type type;
+    char *target;
+} redir;
+
+typedef struct {
+    char **argv;
+    int argc;
+    redir *redirs;
+    int n_redirs;
+    bool expand;        // some word or target carries a VAR_MARK
+} simple_cmd;
+
+typedef enum { TIME_NONE, TIME_TEXT, TIME_JSON } time_mode;
+
+typedef struct {
+    simple_cmd *cmds;
+    int n_cmds;
+    char *text;         // source text, used as the job name
+    time_mode timed;    // prefixed with `time` or `time -j`
+    char **limits;      // NAME=VALUE words of a `limit` prefix
+    int n_limits;
+    bool or_if;         // joined to the previous pipeline by || not &&
+} pipeline;
+
+typedef struct {
+    pipeline *pipes;    // joined by && and ||
+    int n_pipes;
+    bool background;
+} and_or;
+
+typedef struct {
+    and_or *items;
+    int n_items;
+} sequence;
+
+sequence *parse_line(arena *a, const char *line);
 
 #endif
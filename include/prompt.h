@@ -3,9 +3,13 @@
 
 #include "./shell.h"
 
+#include <stddef.h>
+
 #define PATH_MAX 4096
+#define PROMPT_MAX (PATH_MAX + 512)
 
 void init_prompt(shell_state *st) ;
+size_t prompt_format(const shell_state *st, char *out, size_t n) ;
 void show_prompt(const shell_state *st) ;
 
 #endif 
\ No newline at end of file
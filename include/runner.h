@@ -1,5 +1,6 @@
 #pragma once 
 #include<unistd.h>
 
-void norm_and_and(const char *in, char *out, size_t cap);
-int run_sequence(const char *line) ;
+#include "parser.h"
+
+int run_sequence(sequence *seq) ;
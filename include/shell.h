@@ -2,29 +2,113 @@
 #define SHELL_H
 
 #include <limits.h>
+#include <time.h>
 #include <sys/types.h>
 
-#define LOG_SIZE 15
-#define MAX_JOBS 128
+#include "arena.h"
 
-typedef enum { JOB_NONE = 0, JOB_RUNNING = 1, JOB_STOPPED = 2 } job_state;
+typedef enum { JOB_NONE = 0, JOB_RUNNING = 1, JOB_STOPPED = 2, JOB_DONE = 3 } job_state;
+
+// CPU, memory and I/O of a process or a whole job, see jobstat.c.
+typedef struct {
+    double cpu;             // user + sys seconds, reaped children included
+    long rss_kb;            // resident now; ru_maxrss once exited
+    unsigned long long rchar, wchar;
+} job_usage;
 
 typedef struct {
     pid_t pid;
-    pid_t pgid;
+    int status;             // raw wait status once exited
+    int exited;
+    int stopped;
+    job_usage use;          // final figures, filled in when reaped
+} job_proc;
+
+struct limit_group;
+
+// One background or stopped pipeline. The job is done once every member
+// has exited; its status is that of the last stage.
+typedef struct {
     int id;
-    char cmd[1024];
-    int active;
+    pid_t pgid;             // 0 when the members share the shell's group
+    const char *cmd;        // interned, shared by jobs with the same text
     job_state state;
-} bg_job;
+    job_proc *procs;
+    int n_procs;
+    int n_live;             // members that have not exited
+    int slot;               // position in job_table.list
+    struct timespec start, end;
+    job_usage live;         // last /proc sample of the running processes
+    double prev_cpu;        // total CPU at prev_at, for jobs -l's CPU%
+    struct timespec prev_at;
+    struct limit_group *limits; // cgroup of a `limit` job, freed with it
+} job;
+
+// Open-addressing map from a pid to its job, see jobs.c.
+typedef struct {
+    pid_t *keys;
+    job **vals;
+    size_t cap;
+    size_t used;            // live keys plus tombstones
+} pid_index;
+
+typedef struct {
+    job **list;             // unordered; removal swaps in the last job
+    int n, cap;
+    pid_index by_pid;       // every member pid
+    pid_index by_pgid;      // process group leaders
+    int next_id;
+} job_table;
+
+typedef struct {
+    int lastpipe;
+    int splice;         // pass-through `cat` stages copy in the kernel
+    long pipe_size;     // F_SETPIPE_SZ for pipeline pipes, 0 = kernel default
+} shell_options;
+
+// Command history, see history.c. Entries added this session sit in a ring of
+// HISTSIZE slots and their text in a FIFO of chunks; a chunk is freed once
+// every entry in it has been evicted. Older entries come from the mapped file.
+typedef struct hist_chunk {
+    struct hist_chunk *next;
+    size_t used, cap;
+    size_t live;            // entries still pointing into data
+    char data[];
+} hist_chunk;
+
+typedef struct {
+    char *text;
+    hist_chunk *chunk;
+} hist_entry;
+
+typedef struct {
+    hist_entry *ring;
+    size_t cap;             // HISTSIZE
+    size_t head, n;         // oldest slot, entries held
+    hist_chunk *oldest, *newest;
+
+    // The history file as it was at startup, mapped and indexed back from
+    // its end only as far as an entry has been asked for.
+    char *map;
+    size_t map_len;
+    size_t scan;            // map[0, scan) is not indexed yet
+    char **file_ent;        // file_ent[i]: the file's (i + 1)th newest entry
+    size_t file_n, file_cap;
+    long file_lines;        // lines indexed so far, blank ones included
+} history_store;
 
 typedef struct shell_state {
     char home[PATH_MAX];
     char prev[PATH_MAX];
-    char log[LOG_SIZE][1024];
-    int log_count;
-    bg_job jobs[MAX_JOBS];
-    int next_job_id;
+    history_store hist;
+    job_table jobs;
+    shell_options opts;
+    arena line_arena;       // parse and exec state of the current input line
+    int last_status;        // $?
+    int *pipestatus;        // $PIPESTATUS: per-stage statuses of the last
+    int n_pipestatus;       // foreground pipeline
+    int job_control;        // process groups and terminal hand-off; off in
+                            // the subshell of a background `a && b &`
 } shell_state;
 
 // void shell_exec_line(shell_state *st, const char *line);
@@ -6,6 +6,8 @@
 void signals_init() ;
 void signals_set_fg_pgid(pid_t pgid, const char *cmd) ;
 pid_t signals_get_fg_pgid() ;   
-void signals_handle_pending(void) ;
+int signals_chld_fd(void) ;
+int signals_drain_chld(void) ;
+int signals_take_interrupt(void) ;
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// One pipeline stage as seen by the reaper. pid is 0 for a stage that ran
+// inside the shell; its ru is then a getrusage(RUSAGE_SELF) delta.
+typedef struct {
+    pid_t pid;
+    const char *name;
+    int status;
+    int done;
+    struct rusage ru;
+    struct timespec end;
+} stage_stat;
+
+double timing_tv_sec(struct timeval tv) ;
+double timing_elapsed(const struct timespec *from, const struct timespec *to) ;
+void timing_self_delta(struct rusage *ru, const struct rusage *before) ;
+void timing_report(const char *text, const stage_stat *st, int n, const struct timespec *start, int json) ;
+
+#endif
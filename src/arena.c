@@ -0,0 +1,104 @@
+#include "../include/arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#define ARENA_CHUNK 16384
+#define ARENA_ALIGN sizeof(max_align_t)
+
+struct arena_chunk {
+    arena_chunk *next;
+    size_t cap;
+    size_t used;
+    size_t last;        // offset of the most recent allocation
+    max_align_t data[];
+};
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static arena_chunk *new_chunk(size_t need) {
+    size_t cap = need > ARENA_CHUNK ? need : ARENA_CHUNK;
+    arena_chunk *c = malloc(sizeof(*c) + cap);
+    if(!c) {
+        perror("malloc");
+        exit(1);
+    }
+    c -> cap = cap;
+    c -> used = c -> last = 0;
+    c -> next = NULL;
+    return c;
+}
+
+void *arena_alloc(arena *a, size_t n) {
+    n = align_up(n ? n : 1);
+
+    arena_chunk *c = a -> head;
+    if(!c || c -> used + n > c -> cap) {
+        c = new_chunk(n);
+        c -> next = a -> head;
+        a -> head = c;
+    }
+    char *p = (char *)c -> data + c -> used;
+    c -> last = c -> used;
+    c -> used += n;
+
+    a -> used += n;
+    if(a -> used > a -> peak) a -> peak = a -> used;
+    return p;
+}
+
+// Grows the most recent allocation in place when it still fits its chunk,
+// so argv arrays and expansion buffers built one element at a time stay put.
+void *arena_realloc(arena *a, void *p, size_t old_n, size_t new_n) {
+    arena_chunk *c = a -> head;
+
+    if(p && c && p == (char *)c -> data + c -> last) {
+        size_t need = c -> last + align_up(new_n ? new_n : 1);
+        if(need <= c -> cap) {
+            if(need > c -> used) a -> used += need - c -> used;
+            if(a -> used > a -> peak) a -> peak = a -> used;
+            c -> used = need;
+            return p;
+        }
+    }
+    void *q = arena_alloc(a, new_n);
+    if(p && old_n) memcpy(q, p, old_n < new_n ? old_n : new_n);
+    return q;
+}
+
+char *arena_strndup(arena *a, const char *s, size_t n) {
+    char *d = arena_alloc(a, n + 1);
+    memcpy(d, s, n);
+    d[n] = '\0';
+    return d;
+}
+
+// Keeps one standard-sized chunk for the next line; oversized chunks made
+// for a single huge line are returned to malloc.
+void arena_reset(arena *a) {
+    arena_chunk *keep = NULL;
+    arena_chunk *c = a -> head;
+
+    while(c) {
+        arena_chunk *next = c -> next;
+        if(!keep && c -> cap == ARENA_CHUNK) keep = c;
+        else free(c);
+        c = next;
+    }
+    if(keep) {
+        keep -> used = keep -> last = 0;
+        keep -> next = NULL;
+    }
+    a -> head = keep;
+    a -> used = 0;
+}
+
+void arena_release(arena *a) {
+    arena_reset(a);
+    free(a -> head);
+    a -> head = NULL;
+}
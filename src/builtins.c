@@ -7,10 +7,59 @@
 #include "../include/helpers.h"
 #include "../include/runner.h"
 #include "../include/builtins.h"    
+#include "../include/cmdhash.h"
+#include "../include/jobs.h"
+#include "../include/parallel.h"
+#include "../include/shell.h"
 
 extern char **environ;
+extern shell_state global_shell_state;
 static char *prev_dir = NULL;
 
+static const char *builtin_names[] = {
+    "cd", "pwd", "echo", "env",
+    "setenv", "unsetenv", "which", "exit",
+    "hash", "set", "jobs", "fg",
+    "bg", "wait", "kill", "parallel"
+};
+#define N_BUILTINS (int)(sizeof(builtin_names) / sizeof(builtin_names[0]))
+
+int builtin_find(const char *name) {
+    if (!name) return -1;
+
+    for (int i = 0; i < N_BUILTINS; i++) {
+        if (strcmp(name, builtin_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// The idx-th builtin's name, or NULL past the last.
+const char *builtin_name(int idx) {
+    return idx >= 0 && idx < N_BUILTINS ? builtin_names[idx] : NULL;
+}
+
+int builtin_run(int idx, char **args) {
+    switch (idx) {
+        case 0: return command_cd(args);
+        case 1: return command_pwd();
+        case 2: return command_echo(args, NULL);
+        case 3: return command_env(NULL);
+        case 4: return command_setenv(args);
+        case 5: return command_unsetenv(args);
+        case 6: return command_which(args, NULL);
+        case 7: return command_exit(args);
+        case 8: return command_hash(args);
+        case 9: return command_set(args);
+        case 10: return command_jobs(args);
+        case 11: return command_fg(args);
+        case 12: return command_bg(args);
+        case 13: return command_wait(args);
+        case 14: return command_kill(args);
+        case 15: return command_parallel(args);
+    }
+    return 1;
+}
+
 
 int command_cd(char **args) {
 
@@ -111,60 +160,22 @@ int command_env(char **env) {
     return 0;
 }
 
-static char *find_in_path(const char *cmd, char **env) {
-
-    char *path = env ?
-        my_getenv("PATH", env) :
-        getenv("PATH");
-
-    if (!path) return NULL;
-
-    char *dup = strdup(path);
-    if (!dup) {
-        perror("strdup");
-        return NULL;
-    }
-
-    char buf[1024];
-    char *tok = strtok(dup, ":");
-
-    while (tok) {
-        snprintf(buf, sizeof(buf), "%s/%s", tok, cmd);
-
-        if (access(buf, X_OK) == 0) {
-            char *res = strdup(buf);
-            free(dup);
-            return res;
-        }
-
-        tok = strtok(NULL, ":");
-    }
-    free(dup);
-    return NULL;
-}
-
 int command_which(char **args, char **env) {
+    (void) env ;
 
     if (!args[1]) {
         fprintf(stderr, "which: expected argument\n");
         return 1;
     }
 
-    const char *builtins[] = {
-        "cd","pwd","echo","env",
-        "setenv","unsetenv","which","exit"
-    };
-
-    size_t n = sizeof(builtins)/sizeof(builtins[0]);
-
-    for (size_t i = 0; i < n; i++) {
-        if (strcmp(args[1], builtins[i]) == 0) {
-            printf("%s: shell built-in command\n", args[1]);
-            return 0;
-        }
+    if (builtin_find(args[1]) >= 0) {
+        printf("%s: shell built-in command\n", args[1]);
+        return 0;
     }
 
-    char *res = find_in_path(args[1], env);
+    const char *res = strchr(args[1], '/') ?
+        (access(args[1], X_OK) == 0 ? args[1] : NULL) :
+        cmdhash_lookup(args[1]);
 
     if (!res) {
         printf("%s not found\n", args[1]);
@@ -172,7 +183,6 @@ int command_which(char **args, char **env) {
     }
 
     printf("%s\n", res);
-    free(res);
 
     return 0;
 }
@@ -202,6 +212,7 @@ int command_setenv(char **args) {
             perror("setenv");
             return 1;
         }
+        if (strcmp(name, "PATH") == 0) cmdhash_reset();
     }
     else if (args[2]) {
 
@@ -209,6 +220,7 @@ int command_setenv(char **args) {
             perror("setenv");
             return 1;
         }
+        if (strcmp(args[1], "PATH") == 0) cmdhash_reset();
     }
     else {
         fprintf(stderr,
@@ -228,5 +240,92 @@ int command_unsetenv(char **args) {
         perror("unsetenv");
         return 1;
     }
+    if (strcmp(args[1], "PATH") == 0) cmdhash_reset();
     return 0;
 }
+
+static struct {
+    const char *name;
+    int *value;
+} shell_opts[] = {
+    { "lastpipe", &global_shell_state.opts.lastpipe },
+    { "splice",   &global_shell_state.opts.splice },
+};
+#define N_SHELL_OPTS (int)(sizeof(shell_opts) / sizeof(shell_opts[0]))
+
+static struct {
+    const char *name;
+    long *value;
+} size_opts[] = {
+    { "pipesize", &global_shell_state.opts.pipe_size },
+};
+#define N_SIZE_OPTS (int)(sizeof(size_opts) / sizeof(size_opts[0]))
+
+static int set_size_opt(const char *arg) {
+    const char *eq = strchr(arg, '=');
+
+    for (int i = 0; i < N_SIZE_OPTS; i++) {
+        size_t n = strlen(size_opts[i].name);
+        if (strncmp(arg, size_opts[i].name, n) || arg + n != eq) continue;
+
+        long long v = parse_size(eq + 1);
+        if (v < 0 || v > INT_MAX) {
+            fprintf(stderr, "set: %s: invalid size\n", eq + 1);
+            return 1;
+        }
+        *size_opts[i].value = (long)v;
+        return 0;
+    }
+    fprintf(stderr, "set: %.*s: invalid option name\n", (int)(eq - arg), arg);
+    return 1;
+}
+
+int command_set(char **args) {
+
+    if (!args[1] || (strcmp(args[1], "-o") == 0 && !args[2])) {
+        for (int i = 0; i < N_SHELL_OPTS; i++) {
+            printf("%-15s %s\n", shell_opts[i].name, *shell_opts[i].value ? "on" : "off");
+        }
+        for (int i = 0; i < N_SIZE_OPTS; i++) {
+            if (*size_opts[i].value) printf("%-15s %ld\n", size_opts[i].name, *size_opts[i].value);
+            else printf("%-15s %s\n", size_opts[i].name, "default");
+        }
+        return 0;
+    }
+    if (strchr(args[1], '=')) {
+        return set_size_opt(args[1]);
+    }
+    if ((strcmp(args[1], "-o") && strcmp(args[1], "+o")) || !args[2]) {
+        fprintf(stderr, "Usage: set [-o | +o] [option] | set option=size\n");
+        return 1;
+    }
+    for (int i = 0; i < N_SHELL_OPTS; i++) {
+        if (strcmp(args[2], shell_opts[i].name) == 0) {
+            *shell_opts[i].value = (args[1][0] == '-');
+            return 0;
+        }
+    }
+    fprintf(stderr, "set: %s: invalid option name\n", args[2]);
+    return 1;
+}
+
+// `exit` without an argument keeps the status of the last command, so a
+// script ending in `exit` reports its last failure.
+int command_exit(char **args) {
+    int status = global_shell_state.last_status;
+
+    if (args[1]) {
+        char *end;
+        long v = strtol(args[1], &end, 10);
+        if (*end || end == args[1]) {
+            fprintf(stderr, "exit: %s: numeric argument required\n", args[1]);
+            status = 2;
+        }
+        else {
+            status = (int)(v & 0xff);
+        }
+    }
+    fflush(stdout);
+    jobs_close_limits(&global_shell_state);
+    exit(status);
+}
@@ -0,0 +1,202 @@
+#include "../include/posix_lib.h"
+#include "../include/cmdhash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CMDHASH_BUCKETS 256
+
+typedef struct cmd_entry {
+    char *name;
+    char *path;
+    unsigned hits;
+    struct cmd_entry *next;
+} cmd_entry;
+
+typedef struct {
+    char *dir;
+    struct timespec mtime;
+} path_dir;
+
+static cmd_entry *buckets[CMDHASH_BUCKETS];
+static int n_entries = 0;
+
+static path_dir *dirs = NULL;
+static int n_dirs = 0;
+static int dirs_loaded = 0;
+static time_t last_check = 0;
+static unsigned generation = 0;
+
+static unsigned hash_name(const char *s) {
+    unsigned h = 5381;
+    for( ; *s ; s++) h = h * 33 + (unsigned char)*s;
+    return h % CMDHASH_BUCKETS;
+}
+
+static void stat_dir(path_dir *d) {
+    struct stat sb;
+    if(stat(d -> dir, &sb) == 0) d -> mtime = sb.st_mtim;
+    else d -> mtime.tv_sec = d -> mtime.tv_nsec = 0;
+}
+
+static void flush_entries(void) {
+    for(int i = 0 ; i < CMDHASH_BUCKETS ; i++) {
+        cmd_entry *e = buckets[i];
+        while(e) {
+            cmd_entry *next = e -> next;
+            free(e -> name);
+            free(e -> path);
+            free(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+    n_entries = 0;
+    generation++;
+}
+
+static void load_dirs(void) {
+    const char *path = getenv("PATH");
+
+    dirs_loaded = 1;
+    last_check = time(NULL);
+    if(!path) return;
+
+    char *dup = strdup(path);
+    if(!dup) {
+        perror("strdup");
+        return;
+    }
+    int cap = 1;
+    for(const char *p = path ; *p ; p++) cap += (*p == ':');
+
+    dirs = calloc(cap, sizeof(*dirs));
+    if(!dirs) {
+        free(dup);
+        return;
+    }
+    char *save;
+    for(char *tok = strtok_r(dup, ":", &save) ; tok ; tok = strtok_r(NULL, ":", &save)) {
+        dirs[n_dirs].dir = strdup(tok);
+        if(!dirs[n_dirs].dir) break;
+        stat_dir(&dirs[n_dirs++]);
+    }
+    free(dup);
+}
+
+// A PATH directory gains or loses an entry whenever its mtime moves; re-stat
+// them at most once a second so a hit stays a single table probe.
+static void revalidate(void) {
+    if(!dirs_loaded) {
+        load_dirs();
+        return;
+    }
+    time_t now = time(NULL);
+    if(now == last_check) return;
+    last_check = now;
+
+    int stale = 0;
+    for(int i = 0 ; i < n_dirs ; i++) {
+        struct timespec old = dirs[i].mtime;
+        stat_dir(&dirs[i]);
+        if(old.tv_sec != dirs[i].mtime.tv_sec || old.tv_nsec != dirs[i].mtime.tv_nsec) stale = 1;
+    }
+    if(stale) flush_entries();
+}
+
+static char *search_dirs(const char *name) {
+    char buf[4096];
+
+    for(int i = 0 ; i < n_dirs ; i++) {
+        snprintf(buf, sizeof(buf), "%s/%s", dirs[i].dir, name);
+        if(access(buf, X_OK) == 0) return strdup(buf);
+    }
+    return NULL;
+}
+
+const char *cmdhash_lookup(const char *name) {
+    if(!name || !*name || strchr(name, '/')) return NULL;
+
+    revalidate();
+
+    unsigned h = hash_name(name);
+    for(cmd_entry *e = buckets[h] ; e ; e = e -> next) {
+        if(!strcmp(e -> name, name)) {
+            e -> hits++;
+            return e -> path;
+        }
+    }
+
+    char *path = search_dirs(name);
+    if(!path) return NULL;
+
+    cmd_entry *e = malloc(sizeof(*e));
+    if(!e || !(e -> name = strdup(name))) {
+        free(e);
+        free(path);
+        return NULL;
+    }
+    e -> path = path;
+    e -> hits = 1;
+    e -> next = buckets[h];
+    buckets[h] = e;
+    n_entries++;
+    return path;
+}
+
+// Moves on whenever the table is flushed, which it is when a PATH directory
+// changes, so caches built from the directories know to start over.
+unsigned cmdhash_generation(void) {
+    revalidate();
+    return generation;
+}
+
+// The i-th PATH directory, or NULL past the last.
+const char *cmdhash_dir(int i) {
+    if(!dirs_loaded) load_dirs();
+    return i >= 0 && i < n_dirs ? dirs[i].dir : NULL;
+}
+
+void cmdhash_reset(void) {
+    flush_entries();
+    for(int i = 0 ; i < n_dirs ; i++) free(dirs[i].dir);
+    free(dirs);
+    dirs = NULL;
+    n_dirs = 0;
+    dirs_loaded = 0;
+}
+
+int command_hash(char **args) {
+
+    if(args[1] && !strcmp(args[1], "-r")) {
+        flush_entries();
+        return 0;
+    }
+    if(args[1]) {
+        int ret = 0;
+        for(int i = 1 ; args[i] ; i++) {
+            if(!cmdhash_lookup(args[i])) {
+                fprintf(stderr, "hash: %s: not found\n", args[i]);
+                ret = 1;
+            }
+        }
+        return ret;
+    }
+
+    revalidate();
+    if(n_entries == 0) {
+        printf("hash: hash table empty\n");
+        return 0;
+    }
+    printf("hits\tcommand\n");
+    for(int i = 0 ; i < CMDHASH_BUCKETS ; i++) {
+        for(cmd_entry *e = buckets[i] ; e ; e = e -> next) {
+            printf("%4u\t%s\n", e -> hits, e -> path);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,399 @@
+#define _DEFAULT_SOURCE
+
+#include "../include/posix_lib.h"
+#include "../include/complete.h"
+#include "../include/cmdhash.h"
+#include "../include/builtins.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Tab completion. Command names come from a trie of the builtins and every
+// executable in the PATH directories, file names from a cache of directory
+// listings that is kept for as long as the directory's mtime stays put.
+//
+// Nothing is read all at once. complete_word() only starts reading what it
+// lacks and says so; complete_idle(), which the line editor calls while no
+// key is waiting, then reads COMPLETE_STEP entries at a time, and the
+// editor retries the Tab once it is done unless another key came first. A
+// directory of 100k entries costs idle time rather than typing latency.
+//
+// The trie starts over when cmdhash's generation moves on, which happens
+// when PATH is set or one of its directories changes.
+
+#define COMPLETE_STEP  512      // directory entries read per idle slice
+#define DIR_CACHE_MAX  16
+#define NAME_LEN_MAX   256
+
+// characters a name needs a backslash before to come out of the lexer as is
+#define SPECIAL " \t\\'\"|&;<>$"
+
+typedef struct {
+    uint32_t child, sibling;    // 0 for none; node 0 is the root
+    unsigned char c;
+    unsigned char end;          // a name ends here
+} trie_node;
+
+typedef enum { TRIE_NONE, TRIE_BUILDING, TRIE_DONE } trie_state;
+
+typedef struct {
+    char *path;                 // absolute
+    struct timespec mtime;
+    DIR *dir;                   // open while still being read
+    char *names;                // NUL-terminated, directories ending in '/'
+    size_t len, cap;
+    unsigned used;
+} dir_cache;
+
+static trie_node *nodes = NULL;
+static size_t n_nodes = 0, nodes_cap = 0;
+static trie_state state = TRIE_NONE;
+static unsigned trie_gen = 0;
+static int scan_dir = 0;        // PATH directory being read
+static DIR *scan = NULL;
+
+static dir_cache caches[DIR_CACHE_MAX];
+static unsigned tick = 0;
+
+// Returns the new node's index, or 0 if there is no memory for it.
+static uint32_t new_node(unsigned char c, uint32_t sibling) {
+    if(n_nodes == nodes_cap) {
+        size_t cap = nodes_cap ? nodes_cap * 2 : 4096;
+        trie_node *n = realloc(nodes, cap * sizeof(*n));
+        if(!n) return 0;
+        nodes = n;
+        nodes_cap = cap;
+    }
+    nodes[n_nodes] = (trie_node) { 0, sibling, c, 0 };
+    return n_nodes++;
+}
+
+// Children are kept in byte order, so a walk lists names sorted.
+static void trie_insert(const char *s) {
+    uint32_t at = 0;
+
+    for( ; *s ; s++) {
+        unsigned char c = *s;
+        uint32_t prev = 0, k = nodes[at].child;
+        while(k && nodes[k].c < c) {
+            prev = k;
+            k = nodes[k].sibling;
+        }
+        if(!k || nodes[k].c != c) {
+            uint32_t n = new_node(c, k);
+            if(!n) return;
+            if(prev) nodes[prev].sibling = n;
+            else nodes[at].child = n;
+            k = n;
+        }
+        at = k;
+    }
+    nodes[at].end = 1;
+}
+
+static void trie_start(unsigned gen) {
+    if(scan) closedir(scan);
+    scan = NULL;
+    scan_dir = 0;
+    n_nodes = 0;
+    trie_gen = gen;
+    state = TRIE_NONE;
+    if(new_node(0, 0) != 0) return;
+
+    for(int i = 0 ; builtin_name(i) ; i++) trie_insert(builtin_name(i));
+    state = TRIE_BUILDING;
+}
+
+static int is_command(DIR *d, const struct dirent *de) {
+    struct stat sb;
+
+    if(de -> d_type == DT_DIR) return 0;
+    if(de -> d_type != DT_REG) {
+        if(fstatat(dirfd(d), de -> d_name, &sb, 0) < 0 || !S_ISREG(sb.st_mode)) return 0;
+    }
+    return faccessat(dirfd(d), de -> d_name, X_OK, 0) == 0;
+}
+
+static void trie_step(void) {
+    for(int i = 0 ; i < COMPLETE_STEP ; ) {
+        if(!scan) {
+            const char *path = cmdhash_dir(scan_dir);
+            if(!path) {
+                state = TRIE_DONE;
+                return;
+            }
+            scan = opendir(path);
+            if(!scan) scan_dir++;
+            continue;
+        }
+        struct dirent *de = readdir(scan);
+        if(!de) {
+            closedir(scan);
+            scan = NULL;
+            scan_dir++;
+            continue;
+        }
+        i++;
+        if(is_command(scan, de)) trie_insert(de -> d_name);
+    }
+}
+
+static int is_dir(DIR *d, const struct dirent *de) {
+    struct stat sb;
+
+    if(de -> d_type == DT_DIR) return 1;
+    if(de -> d_type != DT_LNK && de -> d_type != DT_UNKNOWN) return 0;
+    return fstatat(dirfd(d), de -> d_name, &sb, 0) == 0 && S_ISDIR(sb.st_mode);
+}
+
+static void dir_step(dir_cache *dc) {
+    for(int i = 0 ; i < COMPLETE_STEP ; i++) {
+        struct dirent *de = readdir(dc -> dir);
+        if(!de) {
+            closedir(dc -> dir);
+            dc -> dir = NULL;
+            return;
+        }
+        const char *name = de -> d_name;
+        size_t n = strlen(name);
+        // a newline would split the line it is completed into
+        if(!strcmp(name, ".") || !strcmp(name, "..") || strchr(name, '\n')) continue;
+
+        if(dc -> len + n + 2 > dc -> cap) {
+            size_t cap = dc -> cap ? dc -> cap * 2 : 4096;
+            while(cap < dc -> len + n + 2) cap *= 2;
+            char *names = realloc(dc -> names, cap);
+            if(!names) continue;
+            dc -> names = names;
+            dc -> cap = cap;
+        }
+        memcpy(dc -> names + dc -> len, name, n);
+        dc -> len += n;
+        if(is_dir(dc -> dir, de)) dc -> names[dc -> len++] = '/';
+        dc -> names[dc -> len++] = '\0';
+    }
+}
+
+int complete_idle(void) {
+    if(state == TRIE_BUILDING) {
+        trie_step();
+        return 1;
+    }
+    for(int i = 0 ; i < DIR_CACHE_MAX ; i++) {
+        if(caches[i].dir) {
+            dir_step(&caches[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The cache for path, reading it again if its mtime has moved. NULL if it
+// cannot be read.
+static dir_cache *dir_get(const char *path) {
+    struct stat sb;
+    dir_cache *dc = NULL, *lru = &caches[0];
+
+    if(stat(path, &sb) < 0 || !S_ISDIR(sb.st_mode)) return NULL;
+    for(int i = 0 ; i < DIR_CACHE_MAX && !dc ; i++) {
+        if(caches[i].path && !strcmp(caches[i].path, path)) dc = &caches[i];
+        else if(caches[i].used < lru -> used) lru = &caches[i];
+    }
+    if(dc && dc -> mtime.tv_sec == sb.st_mtim.tv_sec && dc -> mtime.tv_nsec == sb.st_mtim.tv_nsec) {
+        dc -> used = ++tick;
+        return dc;
+    }
+
+    if(!dc) {
+        dc = lru;
+        free(dc -> path);
+        dc -> path = strdup(path);
+    }
+    if(dc -> dir) closedir(dc -> dir);
+    dc -> dir = dc -> path ? opendir(path) : NULL;
+    dc -> len = 0;
+    dc -> mtime = sb.st_mtim;
+    dc -> used = ++tick;
+    if(!dc -> dir) {
+        free(dc -> path);
+        dc -> path = NULL;
+        dc -> used = 0;
+        return NULL;
+    }
+    return dc;
+}
+
+static void add_match(completion *c, const char *name, size_t plen) {
+    size_t len = strlen(name);
+
+    if(!c -> list) {
+        c -> list = malloc(COMPLETE_LIST_MAX * sizeof(*c -> list));
+        if(!c -> list) return;
+    }
+    if(c -> n == 0) {
+        c -> common = len;
+    }
+    else {
+        size_t k = plen;
+        while(k < c -> common && k < len && name[k] == c -> list[0][k]) k++;
+        c -> common = k;
+    }
+    if(c -> n_list < COMPLETE_LIST_MAX) {
+        char *copy = strdup(name);
+        if(!copy) return;
+        c -> list[c -> n_list++] = copy;
+    }
+    c -> n++;
+}
+
+static void trie_collect(uint32_t at, char *name, size_t len, size_t plen, completion *c) {
+    if(nodes[at].end) {
+        name[len] = '\0';
+        add_match(c, name, plen);
+    }
+    if(len + 1 >= plen + NAME_LEN_MAX) return;
+    for(uint32_t k = nodes[at].child ; k ; k = nodes[k].sibling) {
+        name[len] = nodes[k].c;
+        trie_collect(k, name, len + 1, plen, c);
+    }
+}
+
+static int complete_command(const char *word, completion *c, size_t *plen) {
+    unsigned gen = cmdhash_generation();
+
+    if(state == TRIE_NONE || gen != trie_gen) trie_start(gen);
+    if(state != TRIE_DONE) return state == TRIE_BUILDING ? -1 : 0;
+
+    uint32_t at = 0;
+    *plen = strlen(word);
+    for(const char *p = word ; *p && at != UINT32_MAX ; p++) {
+        uint32_t k = nodes[at].child;
+        while(k && nodes[k].c < (unsigned char) *p) k = nodes[k].sibling;
+        at = k && nodes[k].c == (unsigned char) *p ? k : UINT32_MAX;
+    }
+    if(at == UINT32_MAX) return 0;
+
+    char *name = malloc(*plen + NAME_LEN_MAX + 1);
+    if(!name) return 0;
+    memcpy(name, word, *plen);
+    trie_collect(at, name, *plen, *plen, c);
+    free(name);
+    return 0;
+}
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// The directory part of word, as an absolute path.
+static int dir_of(const char *word, const char *slash, char *dir, size_t n) {
+    int len = slash - word;
+    const char *home = getenv("HOME");
+    char cwd[PATH_MAX];
+
+    if(!slash) return getcwd(dir, n) ? 0 : -1;
+    if(word[0] == '/') return snprintf(dir, n, "%.*s", len ? len : 1, word) < (int) n ? 0 : -1;
+    if(word[0] == '~' && word[1] == '/' && home)
+        return snprintf(dir, n, "%s%.*s", home, len - 1, word + 1) < (int) n ? 0 : -1;
+    if(!getcwd(cwd, sizeof(cwd))) return -1;
+    return snprintf(dir, n, "%s/%.*s", cwd, len, word) < (int) n ? 0 : -1;
+}
+
+// Names starting with '.' only match a prefix that does.
+static int complete_path(const char *word, completion *c, size_t *plen) {
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    char dir[PATH_MAX];
+
+    if(dir_of(word, slash, dir, sizeof(dir)) < 0) return 0;
+    dir_cache *dc = dir_get(dir);
+    if(!dc) return 0;
+    if(dc -> dir) return -1;
+
+    *plen = strlen(base);
+    for(size_t at = 0 ; at < dc -> len ; at += strlen(dc -> names + at) + 1) {
+        const char *name = dc -> names + at;
+        if(name[0] == '.' && base[0] != '.') continue;
+        if(!strncmp(name, base, *plen)) add_match(c, name, *plen);
+    }
+    if(c -> n_list) qsort(c -> list, c -> n_list, sizeof(*c -> list), cmp_name);
+    return 0;
+}
+
+static int is_break(char c) {
+    return c && strchr(" \t\n|&;<>", c);
+}
+
+static size_t word_start(const char *line, size_t cur) {
+    size_t i = cur;
+    while(i > 0 && (!is_break(line[i - 1]) || (i > 1 && line[i - 2] == '\\'))) i--;
+    return i;
+}
+
+// A word is a command name if nothing but blanks comes between it and the
+// start of its line or of a command.
+static int command_position(const char *line, size_t start) {
+    while(start > 0 && (line[start - 1] == ' ' || line[start - 1] == '\t')) start--;
+    return start == 0 || strchr("|&;\n", line[start - 1]);
+}
+
+// The word as the lexer will see it, without quotes and backslashes.
+static char *unquote(const char *s, size_t n) {
+    char *w = malloc(n + 1), *d = w;
+    if(!w) return NULL;
+    for(size_t i = 0 ; i < n ; i++) {
+        if(s[i] == '\'' || s[i] == '"') continue;
+        if(s[i] == '\\' && i + 1 < n) i++;
+        *d++ = s[i];
+    }
+    *d = '\0';
+    return w;
+}
+
+static char *quote(const char *s, size_t n, int space) {
+    char *q = malloc(2 * n + 2), *d = q;
+    if(!q) return NULL;
+    for(size_t i = 0 ; i < n ; i++) {
+        if(strchr(SPECIAL, s[i])) *d++ = '\\';
+        *d++ = s[i];
+    }
+    if(space) *d++ = ' ';
+    *d = '\0';
+    return q;
+}
+
+int complete_word(const char *line, size_t cur, completion *c) {
+    memset(c, 0, sizeof(*c));
+
+    size_t start = word_start(line, cur), plen = 0;
+    char *word = unquote(line + start, cur - start);
+    if(!word) return 0;
+
+    int got = !strchr(word, '/') && command_position(line, start) ?
+              complete_command(word, c, &plen) : complete_path(word, c, &plen);
+    free(word);
+    if(got < 0 || c -> n == 0) return got;
+
+    // a unique match is finished off; otherwise only what they all share
+    // goes in, cut back to a whole UTF-8 character
+    const char *first = c -> list[0];
+    size_t common = c -> common;
+    while(common > plen && ((unsigned char) first[common] & 0xC0) == 0x80) common--;
+    int space = c -> n == 1 && first[common - 1] != '/';
+    if(common > plen || space) c -> insert = quote(first + plen, common - plen, space);
+    return 0;
+}
+
+void complete_free(completion *c) {
+    for(size_t i = 0 ; i < c -> n_list ; i++) free(c -> list[i]);
+    free(c -> list);
+    free(c -> insert);
+    memset(c, 0, sizeof(*c));
+}
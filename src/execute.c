@@ -1,263 +1,506 @@
+#define _GNU_SOURCE
 #include "../include/execute.h"
 #include "../include/builtins.h"
-#include "../include/helpers.h"
 #include "../include/signals.h"
+#include "../include/launch.h"
+#include "../include/cmdhash.h"
+#include "../include/shell.h"
+#include "../include/parser.h"
+#include "../include/arena.h"
+#include "../include/timing.h"
+#include "../include/jobs.h"
+#include "../include/helpers.h"
+#include "../include/limit.h"
 
 #include<unistd.h>
 #include<stdlib.h>
 #include<stdio.h>
 #include<string.h>
 #include<sys/wait.h>
-#include<fcntl.h>
 #include<ctype.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<sys/sendfile.h>
+#include<sys/resource.h>
+#include<time.h>
 
-#ifndef MAX_INFILES
-#  define MAX_INFILES   8
-#endif
-
-#ifndef MAX_OUTFILES
-#  define MAX_OUTFILES  8
-#endif
+extern shell_state global_shell_state ;
+extern char **environ ;
 
+// Expansion results live in the line arena and are dropped with it once
+// the whole input line has run.
+typedef struct {
+    char **v ;
+    int n, cap ;
+} str_vec ;
 
-static void expand_vars(char *cmd, char *out, size_t sz) {
-    char *w = out;
-    char *end = out + sz - 1;
+typedef struct {
+    char *s ;
+    size_t n, cap ;
+} str_buf ;
 
-    while (*cmd && w < end) {
-        if (*cmd == '$') {
-            cmd++;
-            char var[128];
-            int vi = 0;
-            while (*cmd && (isalnum((unsigned char)*cmd) || *cmd == '_') && vi < 127)
-                var[vi++] = *cmd++;
-            var[vi] = '\0';
+static void vec_push(arena *a, str_vec *v, char *s) {
+    if(v -> n + 1 >= v -> cap) {
+        int ncap = v -> cap ? v -> cap * 2 : 8 ;
+        v -> v = arena_realloc(a, v -> v, v -> cap * sizeof(char *), ncap * sizeof(char *)) ;
+        v -> cap = ncap ;
+    }
+    v -> v[v -> n++] = s ;
+    v -> v[v -> n] = NULL ;
+}
 
-            if (vi > 0) {
-                const char *val = getenv(var);
-                if (val) {
-                    while (*val && w < end) *w++ = *val++;
-                }
-            } else {
-                *w++ = '$'; 
-            }
-        } else {
-            *w++ = *cmd++;
-        }
+static void buf_putc(arena *a, str_buf *b, char c) {
+    if(b -> n + 1 >= b -> cap) {
+        size_t ncap = b -> cap ? b -> cap * 2 : 32 ;
+        b -> s = arena_realloc(a, b -> s, b -> cap, ncap) ;
+        b -> cap = ncap ;
     }
-    *w = '\0';
+    b -> s[b -> n++] = c ;
+    b -> s[b -> n] = '\0' ;
 }
 
-static void trim(char *s) {
-    int n = (int)strlen(s) ;
-    while(n && (s[n - 1] == ' ' || s[n - 1] == '\t')) s[--n] = '\0' ;
-    while (*s == ' '|| *s == '\t') memmove(s, s + 1, strlen(s) + 1 ) ;
+static char *buf_take(arena *a, str_buf *b) {
+    char *s = b -> s ? b -> s : arena_strndup(a, "", 0) ;
+    b -> s = NULL ;
+    b -> n = b -> cap = 0 ;
+    return s ;
 }
 
-static int split_argv(char *cmd, char **argv, int max) {
-    int argc = 0 ;
-    
-    while(*cmd && argc < max) {
-        while(*cmd == ' ' || *cmd == '\t') cmd++ ;
-        if(*cmd == '\0' || argc >= max - 1) break ;
-
-        if(*cmd == '\'' || *cmd == '"') {
-            char quote = *cmd++ ;
-            argv[argc++] = cmd ;
-            while(*cmd && *cmd != quote) cmd++ ;
-            if(*cmd) *cmd++ = '\0' ;
-        }
-        else {
-            argv[argc++] = cmd ;
-            while(*cmd && *cmd != ' ' && *cmd != '\t') cmd++ ;
-            if(*cmd) *cmd++ = '\0' ;
+static int is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' ;
+}
+
+// $? and $PIPESTATUS are shell variables; everything else comes from the
+// environment.
+static const char *var_value(arena *a, const char *name, size_t n) {
+    shell_state *sh = &global_shell_state ;
+
+    if(n == 1 && *name == '?') {
+        char *s = arena_alloc(a, 12) ;
+        snprintf(s, 12, "%d", sh -> last_status) ;
+        return s ;
+    }
+    if(n == 10 && !strncmp(name, "PIPESTATUS", n)) {
+        char *s = arena_alloc(a, sh -> n_pipestatus * 12 + 1) ;
+        char *p = s ;
+        *p = '\0' ;
+        for(int i = 0 ; i < sh -> n_pipestatus ; i++) {
+            p += sprintf(p, i ? " %d" : "%d", sh -> pipestatus[i]) ;
         }
+        return s ;
+    }
+    for(char **e = environ ; *e ; e++) {
+        if(!strncmp(*e, name, n) && (*e)[n] == '=') return *e + n + 1 ;
     }
-    argv[argc] = NULL ;
-    return argc ;
+    return "" ;
 }
 
-static pid_t run_single(char *cmd, int in_fd, int out_fd, int wait_fg, int bg_detach_stdin, pid_t pg_lead) {
+// Expands the VAR_MARKs of a cooked word. With split set, the value of an
+// unquoted expansion is broken into fields on blanks and an empty unquoted
+// expansion yields no field at all; otherwise the result is one string.
+static void expand_word(arena *a, const char *w, str_vec *out, int split) {
+    str_buf cur = {0} ;
+    int have = 0 ;
 
+    while(*w) {
+        if(*w != VAR_MARK && *w != VAR_MARK_Q) {
+            buf_putc(a, &cur, *w++) ;
+            have = 1 ;
+            continue ;
+        }
+        int quoted = !split || *w == VAR_MARK_Q ;
+        const char *name = ++w ;
+        if(*w == '?') w++ ;
+        else while(is_name_char(*w)) w++ ;
+        const char *val = var_value(a, name, w - name) ;
 
+        if(quoted) have = 1 ;
+        for( ; *val ; val++) {
+            if(!quoted && (*val == ' ' || *val == '\t' || *val == '\n')) {
+                if(have) vec_push(a, out, buf_take(a, &cur)) ;
+                have = 0 ;
+                continue ;
+            }
+            buf_putc(a, &cur, *val) ;
+            have = 1 ;
+        }
+    }
+    if(have || !split) vec_push(a, out, buf_take(a, &cur)) ;
+}
 
-    char *infiles[MAX_INFILES] ; int n_in = 0 ;
-    char *outfiles[MAX_OUTFILES] ; int n_out = 0 ;
-    int append [MAX_OUTFILES] ;
+// Builtins run inside the shell, so their redirections are applied to the
+// shell's own stdin/stdout and undone once the builtin returns. Every file is
+// opened before anything is touched, so a failed open leaves the shell as is.
+// in_fd is the pipe feeding a lastpipe stage, or STDIN_FILENO.
+static int run_builtin_inline(int idx, char **argv, int in_fd, char **infiles, int n_in,
+                              char **outfiles, int *append, int n_out) {
+    int cur_in = -1, cur_out = -1 ;
 
-    for(char *p = cmd ; (p = strpbrk(p, "<>") ) ; ) {
-        if(*p == '<') {
-            *p++ = '\0' ;
-            while(*p == ' ' || *p == '\t') p++ ;
-            if(*p == '\0' || n_in >= MAX_INFILES) continue ;
-            infiles[n_in++] = strtok(p, " \t");
-        }
-        else if(*p == '>' && *(p + 1) == '>') {
-            *p = '\0' ; p += 2;
-            while(*p == ' ' || *p == '\t') p++ ;
-            if(*p == '\0' || n_out >= MAX_OUTFILES) continue ;
-            outfiles[n_out] =  strtok(p, " \t"); append[n_out++] = 1 ;
+    for(int i = 0 ; i < n_in ; i++) {
+        int fd = open(infiles[i], O_RDONLY | O_CLOEXEC) ;
+        if(cur_in >= 0) close(cur_in) ;
+        if(fd < 0) {
+            perror(infiles[i]) ;
+            return 1 ;
         }
-        else {
-            *p++ = '\0' ; 
-            while(*p == ' ' || *p == '\t') p++ ;
-            if(*p == '\0' || n_out >= MAX_OUTFILES) continue ;
-            outfiles[n_out] =  strtok(p, " \t"); append[n_out++] = 0 ;
+        cur_in = fd ;
+    }
+    for(int i = 0 ; i < n_out ; i++) {
+        int fd = open(outfiles[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append[i] ? O_APPEND : O_TRUNC), 0666) ;
+        if(fd < 0) {
+            if(cur_in >= 0) close(cur_in) ;
+            if(cur_out >= 0) close(cur_out) ;
+            printf("Unable to create file for writing\n") ;
+            return 1 ;
         }
+        if(cur_out >= 0) close(cur_out) ;
+        cur_out = fd ;
     }
-    trim(cmd) ;
-    if(cmd[0] == '\0') return -1 ;
 
-    char expanded[2048];
-    expand_vars(cmd, expanded, sizeof(expanded));
+    fflush(stdout) ;
+    int saved_in = -1, saved_out = -1 ;
+    if(cur_in < 0 && in_fd != STDIN_FILENO) {
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10) ;
+        dup2(in_fd, STDIN_FILENO) ;
+    }
+    else if(cur_in >= 0) {
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10) ;
+        dup2(cur_in, STDIN_FILENO) ;
+        close(cur_in) ;
+    }
+    if(cur_out >= 0) {
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10) ;
+        dup2(cur_out, STDOUT_FILENO) ;
+        close(cur_out) ;
+    }
 
-    char *argv[64] ;
-    int argc = split_argv(expanded, argv, 64) ;
+    int ret = builtin_run(idx, argv) ;
 
-    if (argc == 0 || argv[0] == NULL) {
-        _exit(0);
+    fflush(stdout) ;
+    if(saved_out >= 0) {
+        dup2(saved_out, STDOUT_FILENO) ;
+        close(saved_out) ;
     }
-   
-    pid_t pid = fork() ;
+    if(saved_in >= 0) {
+        dup2(saved_in, STDIN_FILENO) ;
+        close(saved_in) ;
+        clearerr(stdin) ;
+    }
+    return ret ;
+}
 
-    if( pid == 0 ) { 
+// Stage body for a bare `cat` under `set -o splice`: the child moves stdin
+// to stdout inside the kernel. splice() needs a pipe on one side, sendfile()
+// a regular file as the source; anything else falls back to read/write.
+static int passthrough(int idx, char **argv) {
+    (void) idx ; (void) argv ;
+    const size_t chunk = 1 << 20 ;
+    ssize_t n ;
 
-        if(pg_lead > 0) setpgid(0, pg_lead) ;
-        else setpgid(0, 0) ;
+    while((n = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL, chunk, SPLICE_F_MOVE)) != 0) {
+        if(n > 0) continue ;
+        if(errno == EINTR) continue ;
+        if(errno != EINVAL) return 1 ;
 
-        int cur_in = -1 ;
-        for(int i = 0 ; i < n_in ; i++) {
-            int fd = open(infiles[i], O_RDONLY) ;
-            if(cur_in >= 0) close(cur_in) ;
-            if(fd < 0) {
-                perror(infiles[i]) ;
-                exit(1) ;
-            }
-            cur_in = fd ;
-        }
-        if(cur_in >= 0) {
-            dup2(cur_in, STDIN_FILENO) ;
-            close(cur_in) ;
-        }
-        else if(in_fd != STDIN_FILENO) {
-            dup2(in_fd, STDIN_FILENO) ;
-            if(bg_detach_stdin) close(in_fd) ;
-        } 
-        else if(!wait_fg && bg_detach_stdin) {
-            int devnull = open("/dev/null", O_RDONLY) ;
-            if(devnull >= 0) {
-                dup2(devnull, STDIN_FILENO) ;
-                close(devnull) ;
+        while((n = sendfile(STDOUT_FILENO, STDIN_FILENO, NULL, chunk)) != 0) {
+            if(n > 0) continue ;
+            if(errno == EINTR) continue ;
+            if(errno != EINVAL) return 1 ;
+
+            char buf[65536] ;
+            while((n = read(STDIN_FILENO, buf, sizeof(buf))) != 0) {
+                if(n < 0) {
+                    if(errno == EINTR) continue ;
+                    return 1 ;
+                }
+                for(ssize_t off = 0 ; off < n ; ) {
+                    ssize_t w = write(STDOUT_FILENO, buf + off, n - off) ;
+                    if(w < 0 && errno != EINTR) return 1 ;
+                    if(w > 0) off += w ;
+                }
             }
+            return 0 ;
         }
+        return 0 ;
+    }
+    return 0 ;
+}
 
-        int cur_out = -1 ;
-        for(int i = 0 ; i < n_out ; i++) {
-            int fd = open(outfiles[i], O_WRONLY | O_CREAT | (append[i] ? O_APPEND : O_TRUNC), 0666) ;
-            if(fd < 0) {
-                printf("Unable to create file for writing\n");
-                _exit(1);
-            }
-            if(cur_out >= 0) close(cur_out) ;
-            cur_out = fd ;
+// A builtin in a forked stage is a subshell with no terminal of its own.
+static int run_builtin_forked(int idx, char **argv) {
+    global_shell_state.job_control = 0 ;
+    return builtin_run(idx, argv) ;
+}
+
+static int is_passthrough(char **argv) {
+    return global_shell_state.opts.splice && !strcmp(argv[0], "cat") && !argv[1] ;
+}
+
+// With inline_builtin set, a builtin runs in the shell process and 0 is
+// returned; otherwise it runs in a forked child, still without an exec.
+static pid_t run_single(simple_cmd *c, int in_fd, int out_fd, int wait_fg, int bg_detach_stdin, pid_t pg_lead, int inline_builtin,
+                        const launch_limits *limits, stage_stat *st) {
+
+    arena *a = &global_shell_state.line_arena ;
+    int n_r = c -> n_redirs ;
+    char **infiles = arena_alloc(a, n_r * sizeof(char *)) ; int n_in = 0 ;
+    char **outfiles = arena_alloc(a, n_r * sizeof(char *)) ; int n_out = 0 ;
+    int *append = arena_alloc(a, n_r * sizeof(int)) ;
+
+    str_vec words = {0} ;
+    str_vec targets = {0} ;
+    char **argv = c -> argv ;
+
+    if(c -> expand) {
+        for(int i = 0 ; i < c -> argc ; i++) expand_word(a, c -> argv[i], &words, 1) ;
+        argv = words.v ;
+    }
+    for(int i = 0 ; i < n_r ; i++) {
+        char *target = c -> redirs[i].target ;
+        if(c -> expand) {
+            expand_word(a, target, &targets, 0) ;
+            target = targets.v[targets.n - 1] ;
         }
-        if(cur_out >= 0) {
-            dup2(cur_out, STDOUT_FILENO) ;
-            close(cur_out) ;
+        if(c -> redirs[i].type == REDIR_IN) {
+            infiles[n_in++] = target ;
         }
-        else if(out_fd != STDOUT_FILENO) {
-            dup2(out_fd, STDOUT_FILENO) ;
-            close(out_fd) ;
+        else {
+            append[n_out] = (c -> redirs[i].type == REDIR_APPEND) ;
+            outfiles[n_out++] = target ;
         }
-        // if (strcmp(argv[0], "echo") == 0)  { command_echo(argv, NULL); _exit(0); }
-        // if (strcmp(argv[0], "pwd") == 0)  { command_pwd(); _exit(0); }
-        // if (strcmp(argv[0], "env") == 0)  { command_env(NULL); _exit(0); }
-        // if (strcmp(argv[0], "which") == 0)  { command_which(argv, NULL); _exit(0); }
-        // printf("Executing command in child: %s\n", argv[0]) ;
-        execvp(argv[0], argv);
-        printf("Command not found!\n");
-        _exit(1);
+    }
+
+    if (!argv || argv[0] == NULL) {
+        st -> status = 0 ;
+        return -1;
+    }
+    st -> name = argv[0] ;
+
+    int bi = builtin_find(argv[0]) ;
+    if(bi >= 0 && inline_builtin) {
+        st -> status = run_builtin_inline(bi, argv, in_fd, infiles, n_in, outfiles, append, n_out) ;
+        return 0 ;
+    }
+
+    int fast = bi < 0 && is_passthrough(argv) ;
+    launch_spec ls = {
+        .path = bi >= 0 || fast ? NULL : cmdhash_lookup(argv[0]),
+        .argv = argv,
+        .builtin = bi >= 0 ? run_builtin_forked : fast ? passthrough : NULL,
+        .builtin_idx = bi,
+        .infiles = infiles, .n_in = n_in,
+        .outfiles = outfiles, .append = append, .n_out = n_out,
+        .in_fd = in_fd, .out_fd = out_fd,
+        .wait_fg = wait_fg, .bg_detach_stdin = bg_detach_stdin,
+        .pg_lead = pg_lead,
+        .limits = limits,
+    } ;
+    pid_t pid = launch_process(&ls) ;
+    if(pid < 0) {
+        perror("fork") ;
+        st -> status = 1 ;
+        return -1 ;
     }
     if(pg_lead > 0) setpgid(pid, pg_lead) ;
     else setpgid(pid, pid) ;
+    return pid ;
+}
+
+// Registers the stages that are still running as one job, which takes
+// over the pipeline's limits; they are released at once if none are left.
+static job *add_job(pid_t pg, const char *name, const stage_stat *st, int n, job_state state, limit_group *lg) {
+    pid_t *pids = arena_alloc(&global_shell_state.line_arena, n * sizeof(pid_t)) ;
+    int live = 0 ;
+
+    for(int i = 0 ; i < n ; i++) {
+        if(st[i].pid > 0 && !st[i].done) pids[live++] = st[i].pid ;
+    }
+    if(!live) {
+        if(lg) limit_close(lg, name) ;
+        return NULL ;
+    }
+    job *j = jobs_add(&global_shell_state, global_shell_state.job_control ? pg : 0, pids, live, name, state) ;
+    j -> limits = lg ;
+    return j ;
+}
 
-    if(wait_fg) {
-        pid_t grp = (pg_lead > 0 ? pg_lead : pid);
-        setpgid(pid, grp);
-        signals_set_fg_pgid(grp, argv[0] ? argv[0] : "");
+static void file_status(stage_stat *st, int n, pid_t pid, int status, const struct rusage *ru) {
+    for(int i = 0 ; i < n ; i++) {
+        if(st[i].pid != pid) continue ;
+        st[i].status = wait_status_code(status) ;
+        st[i].ru = *ru ;
+        st[i].done = 1 ;
+        clock_gettime(CLOCK_MONOTONIC, &st[i].end) ;
+        return ;
+    }
+}
 
-        tcsetpgrp(STDIN_FILENO, grp);
-        
-        int status;
-        waitpid(pid, &status, WUNTRACED);
+// Hands the terminal to group pg and reaps it with wait4(), filing each exit
+// status and rusage under its stage. Without job control the stages share
+// the shell's group with any background jobs, so each pid is waited for by
+// name instead. Returns 0 if the job was stopped; the job then owns lg.
+static int wait_foreground(pid_t pg, const char *name, stage_stat *st, int n, limit_group *lg) {
+    int jc = global_shell_state.job_control ;
+    int status = 0 ;
+    int stopped = 0 ;
+    struct rusage ru ;
+    pid_t pid ;
 
-        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) {
-            write(STDOUT_FILENO, "\n", 1);  // clean newline after ^C
+    if(jc) {
+        signals_set_fg_pgid(pg, name) ;
+        tcsetpgrp(STDIN_FILENO, pg) ;
+
+        while((pid = wait4(-pg, &status, WUNTRACED, &ru)) > 0) {
+            if(WIFSTOPPED(status)) {
+                stopped = 1 ;
+                break ;
+            }
+            file_status(st, n, pid, status, &ru) ;
         }
-        // signals_handle_pending must come BEFORE tcsetpgrp
-        signals_handle_pending();
-        tcsetpgrp(STDIN_FILENO, getpgrp());
-        signals_set_fg_pgid(-1, NULL);
     }
-    return pid ;
+    else {
+        for(int i = 0 ; i < n ; i++) {
+            if(st[i].pid <= 0 || st[i].done) continue ;
+            while((pid = wait4(st[i].pid, &status, 0, &ru)) < 0 && errno == EINTR) {}
+            if(pid > 0) file_status(st, n, pid, status, &ru) ;
+        }
+        return 1 ;
+    }
+    if(WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) {
+        write(STDOUT_FILENO, "\n", 1) ;  // clean newline after ^C
+    }
+    // the job is in the table before the terminal comes back
+    if(stopped) {
+        job *j = add_job(pg, name, st, n, JOB_STOPPED, lg) ;
+        if(j) {
+            printf("[%d] Stopped %s with pid %d\n", j -> id, name, (int) pg) ;
+            fflush(stdout) ;
+        }
+    }
+    tcsetpgrp(STDIN_FILENO, getpgrp()) ;
+    signals_set_fg_pgid(-1, NULL) ;
+    return !stopped ;
 }
 
-int execute_command(char *line, int wait_fg, pid_t  *first_pid) {
+// $PIPESTATUS keeps every stage of the last foreground pipeline, so it grows
+// with the longest pipeline seen and is never shrunk.
+static void save_statuses(const stage_stat *st, int n) {
+    static int cap = 0 ;
+    shell_state *sh = &global_shell_state ;
 
-    // printf("Executing command line: %s\n", line) ;
-    char* parts[16] ;
-    int cnt = 0 ;
-    char *save_ptr ;
-    char *token = strtok_r(line, "|", &save_ptr) ;
+    if(n > cap) {
+        int *p = realloc(sh -> pipestatus, n * sizeof(int)) ;
+        if(!p) {
+            perror("realloc") ;
+            return ;
+        }
+        sh -> pipestatus = p ;
+        cap = n ;
+    }
+    for(int i = 0 ; i < n ; i++) sh -> pipestatus[i] = st[i].status ;
+    sh -> n_pipestatus = n ;
+    sh -> last_status = st[n - 1].status ;
+}
+
+// Applies `set pipesize=N` (or PSH_PIPE_SIZE) to a fresh pipeline pipe. The
+// kernel caps unprivileged sizes at /proc/sys/fs/pipe-max-size, so a refused
+// size is reported once and the option falls back to the default.
+static void size_pipe(int fd) {
+    long size = global_shell_state.opts.pipe_size ;
+    if(size <= 0) return ;
 
-    while (token && cnt < 16) {
-        parts[cnt++] = token ;
-        token = strtok_r(NULL, "|", &save_ptr) ;
+    if(fcntl(fd, F_SETPIPE_SZ, (int)size) < 0) {
+        fprintf(stderr, "psh: pipesize %ld: %s\n", size, strerror(errno)) ;
+        global_shell_state.opts.pipe_size = 0 ;
     }
-    
-    pid_t pg = -1 ;
-    pid_t first = -1 ;
+}
+
+// Expands the NAME=VALUE words of a `limit` prefix. Returns NULL after a
+// bad spec has been reported.
+static limit_group *open_limits(pipeline *pl) {
+    arena *a = &global_shell_state.line_arena ;
+    str_vec specs = {0} ;
 
-    if(cnt == 1) {
-        pid_t p = run_single(parts[0], STDIN_FILENO, STDOUT_FILENO, wait_fg, !wait_fg, -1) ;
-        if(first_pid) *first_pid = p ;
+    for(int i = 0 ; i < pl -> n_limits ; i++) expand_word(a, pl -> limits[i], &specs, 0) ;
+    return limit_open(specs.v, specs.n) ;
+}
+
+// A single foreground stage that is a builtin, and the last stage under
+// lastpipe, run inside the shell unless the pipeline is limited; a builtin
+// sent to the background is forked like any other stage, so it neither
+// holds up the prompt nor changes the shell. Like bash, lastpipe only
+// applies with job control off: the other stages' group would otherwise
+// never own the terminal, so a stage reading it stops on SIGTTIN and ^C or
+// ^Z never reaches them. Everything else becomes one process in group pg.
+// With job control off, pg is the shell's own group. Returns the status of
+// the last stage, 128 + SIGTSTP if the job was stopped, 2 for bad limits,
+// and 0 when it was sent to the background.
+int execute_pipeline(pipeline *pl, int wait_fg, pid_t *first_pid) {
+
+    arena *a = &global_shell_state.line_arena ;
+    int cnt = pl -> n_cmds ;
+    pid_t pg = global_shell_state.job_control ? -1 : getpgrp() ;
+    int fds[2] = {-1, -1} ;
+    int in_fd = STDIN_FILENO ;
+    int lastpipe = cnt > 1 && wait_fg && global_shell_state.opts.lastpipe &&
+                   !global_shell_state.job_control ;
+    int timed = pl -> timed != TIME_NONE && wait_fg ;
+
+    limit_group *lg = NULL ;
+    if(pl -> n_limits && !(lg = open_limits(pl))) {
+        global_shell_state.last_status = 2 ;
+        return 2 ;
     }
-    else {
-        int fds[2] = {-1, -1} ;
-        int in_fd = STDIN_FILENO ;
+    const launch_limits *limits = lg ? limit_launch(lg) : NULL ;
 
-        for(int i = 0 ; i < cnt ; i++) {
-            if(i + 1 < cnt) {
-                pipe(fds) ;
-            }
-            pid_t p = run_single(parts[i], in_fd, (i == cnt - 1) ? STDOUT_FILENO : fds[1], 0, !wait_fg, pg);
-            if(p > 0 && pg == -1) pg = p ;
-            if(!i) first = p ;
-            if(i + 1 < cnt ) {
-                close(fds[1]) ;
-                if(in_fd != STDIN_FILENO) close(in_fd) ;
-                in_fd = fds[0] ;
-            } 
+    stage_stat *st = arena_alloc(a, cnt * sizeof(stage_stat)) ;
+    memset(st, 0, cnt * sizeof(stage_stat)) ;
+    struct timespec start ;
+    if(timed) clock_gettime(CLOCK_MONOTONIC, &start) ;
+
+    for(int i = 0 ; i < cnt ; i++) {
+        int last = (i == cnt - 1) ;
+        int in_shell = !lg && ((cnt == 1 && wait_fg) || (last && lastpipe)) ;
+        struct rusage before = {0} ;
+
+        // close-on-exec, or a stage holds the read end of its own output
+        // and a writer like `yes` never sees EPIPE
+        if(!last) {
+            pipe2(fds, O_CLOEXEC) ;
+            size_pipe(fds[1]) ;
         }
-        // if (wait_fg) { tcsetpgrp(STDIN_FILENO, getpgrp()); signals_set_fg_pgid(-1,NULL); }
-        if (wait_fg && pg > 0) {
-            pid_t grp = pg;
-            signals_set_fg_pgid(grp, parts[0]);   
-            tcsetpgrp(STDIN_FILENO, grp);     
-
-            int status = 0 ;
-    
-            while (waitpid(-pg, &status, WUNTRACED) > 0) {
-                if (WIFSTOPPED(status)) break;      
-            }
-            if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) {
-                write(STDOUT_FILENO, "\n", 1);
-            }
-            signals_handle_pending();
-            tcsetpgrp(STDIN_FILENO, getpgrp());
-            signals_set_fg_pgid(-1, NULL);
+        if(timed && in_shell) getrusage(RUSAGE_SELF, &before) ;
+
+        pid_t p = run_single(&pl -> cmds[i], in_fd, last ? STDOUT_FILENO : fds[1], wait_fg, !wait_fg, pg, in_shell, limits, &st[i]) ;
+        if(p > 0 && pg == -1) pg = p ;
+        if(!i && first_pid) *first_pid = p ;
+
+        st[i].pid = p ;
+        if(p <= 0) {
+            st[i].done = 1 ;
+            if(timed) clock_gettime(CLOCK_MONOTONIC, &st[i].end) ;
+            if(timed && p == 0) timing_self_delta(&st[i].ru, &before) ;
+        }
+        if(!last) {
+            close(fds[1]) ;
+            if(in_fd != STDIN_FILENO) close(in_fd) ;
+            in_fd = fds[0] ;
         }
-        if (first_pid) *first_pid = first;
     }
-    return 0 ;
-} 
+    if(in_fd != STDIN_FILENO) close(in_fd) ;
+
+    if(!wait_fg) {
+        job *j = add_job(pg, pl -> text, st, cnt, JOB_RUNNING, lg) ;
+        if(j && global_shell_state.job_control) printf("[%d] %d\n", j -> id, (int) pg) ;
+        return 0 ;
+    }
+
+    if(pg > 0 && !wait_foreground(pg, pl -> text, st, cnt, lg)) {
+        global_shell_state.last_status = 128 + SIGTSTP ;
+        return global_shell_state.last_status ;
+    }
+    if(lg) limit_close(lg, pl -> text) ;
+    save_statuses(st, cnt) ;
+    if(timed) timing_report(pl -> text, st, cnt, &start, pl -> timed == TIME_JSON) ;
+    return global_shell_state.last_status ;
+}
@@ -5,6 +5,8 @@
 #include<stdlib.h>
 #include<string.h>
 #include<stdio.h>
+#include<limits.h>
+#include<sys/wait.h>
 
 int my_strcmp(const char* str1, const char* str2) {
     // printf("%s\n" , str1 ) ;
@@ -92,6 +94,34 @@ char* my_strncpy(char* dst, char* src, size_t n) {
     return dst ;  
 } 
 
+// Parses a byte count with an optional K, M or G (binary) suffix.
+long long parse_size(const char* str) {
+
+    if(!str || !*str) return -1 ;
+
+    char* end ;
+    long long n = strtoll(str, &end, 10) ;
+    if(end == str || n < 0) return -1 ;
+
+    int shift = 0 ;
+    switch(*end) {
+        case 'k': case 'K': shift = 10 ; end++ ; break ;
+        case 'm': case 'M': shift = 20 ; end++ ; break ;
+        case 'g': case 'G': shift = 30 ; end++ ; break ;
+    }
+    if(*end || n > LLONG_MAX >> shift) return -1 ;
+    return n << shift ;
+}
+
+// Maps a raw wait status to the shell's: the exit code, or 128 + the
+// signal that killed or stopped the process.
+int wait_status_code(int status) {
+    if(WIFEXITED(status)) return WEXITSTATUS(status) ;
+    if(WIFSIGNALED(status)) return 128 + WTERMSIG(status) ;
+    if(WIFSTOPPED(status)) return 128 + WSTOPSIG(status) ;
+    return 0 ;
+}
+
 // char** my_strtok(const char* str, const char* delimeter ) {
     
    
@@ -1,5 +1,8 @@
+#define _DEFAULT_SOURCE
+#include "../include/posix_lib.h"
 #include "../include/builtins.h"
 #include "../include/history.h"
+#include "../include/histsearch.h"
 #include "../include/shell.h"
 #include "../include/helpers.h"
 
@@ -8,6 +11,58 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// In memory, history is a ring of st -> hist.cap entries (HISTSIZE, default
+// HISTORY_SIZE_DEFAULT) whose text is packed into HISTORY_CHUNK-byte chunks
+// appended in entry order. Adding an entry evicts the oldest once the ring is
+// full, and a chunk goes back to malloc when its last live entry is evicted,
+// so both cost O(1) however large the history grows.
+//
+// Entries from earlier sessions are not read at startup. history_load() maps
+// the file privately and nothing more, so the first prompt costs the same
+// with ten lines of history or ten million. history_get() indexes lines back
+// from the end of the map only as far as it is asked to, and materializes
+// each one in place by overwriting its newline with a NUL, which copies just
+// the pages navigation or search actually reaches. The ring and the file
+// together show at most HISTSIZE entries.
+//
+// The history file is append-only and shared by every running session: one
+// O_APPEND fd stays open and every new entry is a single writev() under
+// flock(). Each session remembers read_off, how far into the file it has
+// taken entries in, and history_refresh() preads only what other sessions
+// appended past it. fdatasync() runs once HISTORY_SYNC_LINES entries or
+// HISTORY_SYNC_SECS seconds have gone unsynced, and at exit. The seconds
+// are checked on each append, and by the line editor while it waits at a
+// prompt, so an idle session does not sit on unsynced entries.
+//
+// The file is only rewritten when it grows a quarter past file_max lines,
+// down to its newest file_max. Whoever compacts it then appends a
+// HISTORY_MOVED record to the old inode saying how many bytes were dropped,
+// so sessions still reading the old file carry their offset over to the
+// new one instead of reading it again from the start.
+
+#define HISTORY_SIZE_DEFAULT 100000
+#define HISTORY_CHUNK      (64 * 1024)
+#define HISTORY_FILE_MAX   100000
+#define HISTORY_SYNC_LINES 64
+#define HISTORY_SYNC_SECS  5
+
+// a line no command can produce: '\0' then "<bytes dropped> <lines kept>"
+#define HISTORY_MOVED '\0'
+
+static long file_max = HISTORY_FILE_MAX ;
+static int hist_fd = -1 ;       // read and append, on the inode read_off is in
+static off_t read_off = 0 ;
+static long map_lines = -1 ;    // lines in the startup map, counted on first append
+static long file_lines = 0 ;    // lines read or written past the map
+static int unsynced = 0 ;
+static time_t last_sync = 0 ;
 
 static const char *history_file_path(void) {
     static char path[1024] ;
@@ -37,60 +92,347 @@ static int is_blank (const char *s) {
 }
 
 static int contains_atomic_log(const char *cmd) {
-    char buf[1024] ;
-    strncpy(buf, cmd, sizeof(buf) - 1) ;
-    buf[sizeof(buf) - 1] = '\0' ;
+    const char *delims = " \t|><;&" ;
+
+    while(*cmd) {
+        cmd += strspn(cmd, delims) ;
+        size_t n = strcspn(cmd, delims) ;
+        if(n == 3 && !strncmp(cmd, "log", 3)) return 1 ;
+        cmd += n ;
+    }
+    return 0 ;
+}
+
+static size_t histsize(void) {
+    const char *env = getenv("HISTSIZE") ;
+    char *end ;
+
+    if(!env || !*env) return HISTORY_SIZE_DEFAULT ;
+    long n = strtol(env, &end, 10) ;
+    if(*end || n <= 0) {
+        fprintf(stderr, "psh: HISTSIZE: invalid size %s\n", env) ;
+        return HISTORY_SIZE_DEFAULT ;
+    }
+    return n ;
+}
+
+static int store_init(history_store *h) {
+    if(h -> ring) return 0 ;
+    h -> cap = histsize() ;
+    h -> ring = calloc(h -> cap, sizeof(*h -> ring)) ;
+    if(!h -> ring) {
+        perror("history") ;
+        return -1 ;
+    }
+    if((long) h -> cap > file_max) file_max = h -> cap ;
+    return 0 ;
+}
+
+static void store_evict(history_store *h) {
+    h -> ring[h -> head].chunk -> live-- ;
+    h -> head = (h -> head + 1) % h -> cap ;
+    h -> n-- ;
+
+    // entries are evicted in the order they were packed, so only the
+    // oldest chunk can have just emptied
+    hist_chunk *c = h -> oldest ;
+    if(c -> live > 0) return ;
+    if(c == h -> newest) {
+        c -> used = 0 ;
+        return ;
+    }
+    h -> oldest = c -> next ;
+    free(c) ;
+}
 
-    char *tok = strtok(buf, " \t|><;&") ;
-    for( ; tok ; tok = strtok(NULL, " \t|><;&") ) {
-        if(!strcmp(tok, "log")) return 1 ;
+// Entries longer than a chunk get a chunk of their own.
+static char *store_alloc(history_store *h, size_t len, hist_chunk **out) {
+    hist_chunk *c = h -> newest ;
+
+    if(!c || c -> cap - c -> used < len) {
+        size_t cap = len > HISTORY_CHUNK ? len : HISTORY_CHUNK ;
+        c = malloc(sizeof(*c) + cap) ;
+        if(!c) return NULL ;
+        c -> next = NULL ;
+        c -> used = c -> live = 0 ;
+        c -> cap = cap ;
+        if(h -> newest) h -> newest -> next = c ;
+        else h -> oldest = c ;
+        h -> newest = c ;
+    }
+    char *p = c -> data + c -> used ;
+    c -> used += len ;
+    *out = c ;
+    return p ;
+}
+
+static void store_push(history_store *h, const char *cmd, size_t len) {
+    if(store_init(h) < 0) return ;
+    if(h -> n == h -> cap) store_evict(h) ;
+
+    hist_chunk *c ;
+    char *p = store_alloc(h, len + 1, &c) ;
+    if(!p) return ;
+    memcpy(p, cmd, len) ;
+    p[len] = '\0' ;
+    c -> live++ ;
+
+    hist_entry *e = &h -> ring[(h -> head + h -> n) % h -> cap] ;
+    e -> text = p ;
+    e -> chunk = c ;
+    h -> n++ ;
+    histsearch_add(p) ;
+}
+
+// Indexes the next line back from h -> scan. A trailing line without its
+// newline is a write still in progress and is left alone.
+static int index_line(history_store *h) {
+    while(h -> scan > 0) {
+        size_t end = h -> scan - 1, start = end ;
+        while(start > 0 && h -> map[start - 1] != '\n') start-- ;
+        h -> scan = start ;
+        h -> file_lines++ ;
+
+        h -> map[end] = '\0' ;
+        if(end > start && h -> map[end - 1] == '\r') h -> map[--end] = '\0' ;
+        if(end == start) continue ;
+
+        if(h -> file_n == h -> file_cap) {
+            size_t cap = h -> file_cap ? h -> file_cap * 2 : 256 ;
+            char **ent = realloc(h -> file_ent, cap * sizeof(*ent)) ;
+            if(!ent) return 0 ;
+            h -> file_ent = ent ;
+            h -> file_cap = cap ;
+        }
+        h -> file_ent[h -> file_n++] = h -> map + start ;
+        return 1 ;
     }
     return 0 ;
 }
 
+// Lines of the file as mapped; counting means a pass over the unindexed
+// rest, so it is left until the first append rather than done at startup.
+static long mapped_lines(history_store *h) {
+    long n = h -> file_lines ;
+    const char *p = h -> map, *end = h -> map + h -> scan ;
+
+    while(p < end && (p = memchr(p, '\n', end - p))) {
+        n++ ;
+        p++ ;
+    }
+    return n ;
+}
+
+// Indexes the whole file, so prefer history_get() where a walk can stop.
+size_t history_count(shell_state *st) {
+    history_store *h = &st -> hist ;
+    if(!h -> ring) return 0 ;
+    while(h -> n + h -> file_n < h -> cap && index_line(h)) {}
+    return h -> n + h -> file_n ;
+}
+
+const char *history_get(shell_state *st, size_t back) {
+    history_store *h = &st -> hist ;
+
+    if(back == 0 || !h -> ring || back > h -> cap) return NULL ;
+    if(back <= h -> n) return h -> ring[(h -> head + h -> n - back) % h -> cap].text ;
+
+    size_t k = back - h -> n ;
+    while(h -> file_n < k) {
+        if(!index_line(h)) return NULL ;
+    }
+    return h -> file_ent[k - 1] ;
+}
+
+// Opens whatever file is at the path now and returns its size.
+static off_t open_file(void) {
+    struct stat sb ;
+
+    hist_fd = open(history_file_path(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600) ;
+    last_sync = time(NULL) ;
+    if(hist_fd < 0 || fstat(hist_fd, &sb) < 0) return 0 ;
+    return sb.st_size ;
+}
+
 void history_load(shell_state *st) {
-    FILE *f = fopen(history_file_path(), "r") ;
-    if(!f) return ;
+    history_store *h = &st -> hist ;
+
+    if(store_init(h) < 0) return ;
+    off_t size = open_file() ;
+    if(hist_fd >= 0 && size > 0) {
+        char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, hist_fd, 0) ;
+        if(map != MAP_FAILED) {
+            h -> map = map ;
+            h -> map_len = h -> scan = size ;
+            while(h -> scan > 0 && map[h -> scan - 1] != '\n') h -> scan-- ;
+        }
+    }
+    read_off = h -> scan ;
+}
+
+// Takes in the complete lines past read_off. Returns 1 on a HISTORY_MOVED
+// record, with read_off already moved to where the new file takes over.
+static int take_new(history_store *h) {
+    struct stat sb ;
 
-    char line[4096] ;
-    while(fgets(line, sizeof(line), f)) {
-        size_t n = strlen(line) ;
+    if(fstat(hist_fd, &sb) < 0 || sb.st_size <= read_off) return 0 ;
+    size_t len = sb.st_size - read_off ;
+    char *buf = malloc(len) ;
+    if(!buf) return 0 ;
+    ssize_t got = pread(hist_fd, buf, len, read_off) ;
 
-        if(n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) {
-            line[--n] = '\0' ;
+    char *p = buf, *end = buf + (got > 0 ? got : 0), *nl ;
+    while(p < end && (nl = memchr(p, '\n', end - p))) {
+        if(*p == HISTORY_MOVED) {
+            long long dropped = 0 ;
+            long kept = 0 ;
+            *nl = '\0' ;
+            sscanf(p + 1, "%lld %ld", &dropped, &kept) ;
+            read_off = read_off + (p - buf) - dropped ;
+            map_lines = 0 ;
+            file_lines = kept ;
+            free(buf) ;
+            return 1 ;
         }
-        if(st -> log_count == LOG_SIZE) {
-            for(int i = 0 ; i + 1 < LOG_SIZE ; i++) {
-                strcpy(st -> log[i], st -> log[i + 1]) ;
-            }
-            st -> log_count-- ;
+        size_t n = nl - p ;
+        if(n > 0 && p[n - 1] == '\r') n-- ;
+        if(n > 0) store_push(h, p, n) ;
+        file_lines++ ;
+        p = nl + 1 ;
+    }
+    read_off += p - buf ;
+    free(buf) ;
+    return 0 ;
+}
+
+void history_refresh(shell_state *st) {
+    while(hist_fd >= 0 && take_new(&st -> hist)) {
+        close(hist_fd) ;
+        open_file() ;
+    }
+}
+
+static int same_file(int fd, const char *path) {
+    struct stat a, b ;
+    return fstat(fd, &a) == 0 && stat(path, &b) == 0 &&
+           a.st_dev == b.st_dev && a.st_ino == b.st_ino ;
+}
+
+// Locks the file at the path, caught up to its end. A file replaced by
+// something other than a compaction is taken as read.
+static int lock_file(history_store *h) {
+    for(;;) {
+        if(flock(hist_fd, LOCK_EX) < 0) return -1 ;
+        int moved = take_new(h) ;
+        if(!moved && same_file(hist_fd, history_file_path())) return 0 ;
+
+        close(hist_fd) ;
+        off_t size = open_file() ;
+        if(hist_fd < 0) return -1 ;
+        if(!moved) {
+            read_off = size ;
+            map_lines = file_lines = 0 ;
         }
-        strcpy(st -> log[st -> log_count++], line) ;
     }
-    fclose(f) ;
 }
 
-void history_save(shell_state *st) {
-    FILE *f = fopen(history_file_path(), "w") ;
-    if(!f) return ;
+void history_sync(void) {
+    if(hist_fd < 0 || !unsynced) return ;
+    fdatasync(hist_fd) ;
+    unsynced = 0 ;
+    last_sync = time(NULL) ;
+}
+
+// Milliseconds until history_sync() is due, -1 with nothing unsynced.
+int history_sync_due(void) {
+    if(hist_fd < 0 || !unsynced) return -1 ;
+    long left = (long) (last_sync + HISTORY_SYNC_SECS - time(NULL)) * 1000 ;
+    return left > 0 ? (int) left : 0 ;
+}
 
-    for(int i = 0 ; i < st -> log_count ; i++) {
-        fputs(st -> log[i], f) ;
-        fputc('\n', f) ;
+static int write_all(int fd, const char *p, size_t n) {
+    while(n > 0) {
+        ssize_t w = write(fd, p, n) ;
+        if(w < 0) return -1 ;
+        p += w ;
+        n -= w ;
     }
-    fclose(f) ;
+    return 0 ;
 }
 
+// Called locked and caught up, so read_off is the end of the file. The
+// newest file_max lines go to a temporary file that is synced and renamed
+// over the history, so a crash leaves the old file or the new one, never
+// half of either.
+static void compact(void) {
+    const char *path = history_file_path() ;
+    off_t size = read_off ;
+    if(size == 0) return ;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, hist_fd, 0) ;
+    if(map == MAP_FAILED) return ;
+
+    // walk back over file_max newlines, skipping the file's last one
+    off_t start = size - 1 ;
+    long kept = 0 ;
+    while(start > 0 && kept < file_max) {
+        if(map[--start] == '\n') kept++ ;
+    }
+    if(kept == file_max) start++ ;
+
+    char tmp[1100] ;
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid()) ;
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) ;
+    int ok = out >= 0 && write_all(out, map + start, size - start) == 0 && fsync(out) == 0 ;
+    if(out >= 0) close(out) ;
+    munmap(map, size) ;
+
+    if(!ok || rename(tmp, path) < 0) {
+        unlink(tmp) ;
+        return ;
+    }
+    char rec[64] ;
+    int n = snprintf(rec, sizeof(rec), "%c%lld %ld\n", HISTORY_MOVED, (long long) start, kept) ;
+    write_all(hist_fd, rec, n) ;
+    close(hist_fd) ;
+
+    open_file() ;
+    read_off = size - start ;
+    map_lines = 0 ;
+    file_lines = kept ;
+    unsynced = 0 ;
+}
+
+// A writer killed mid-entry leaves a line without its newline, which is
+// closed off here so the next entry starts on a line of its own.
+static void history_append(history_store *h, const char *cmd) {
+    if(hist_fd < 0) read_off = open_file() ;
+    if(hist_fd < 0 || lock_file(h) < 0) return ;
+    if(map_lines < 0) map_lines = mapped_lines(h) ;
+
+    struct stat sb ;
+    int torn = fstat(hist_fd, &sb) == 0 && sb.st_size > read_off ;
+    size_t len = strlen(cmd) ;
+    struct iovec iov[3] = {
+        { "\n", torn },
+        { (void *) cmd, len },
+        { "\n", 1 },
+    } ;
+    if(writev(hist_fd, iov, 3) == (ssize_t)(torn + len + 1)) {
+        read_off = sb.st_size + torn + len + 1 ;
+        file_lines++ ;
+        unsynced++ ;
+        if(map_lines + file_lines > file_max + file_max / 4) compact() ;
+        else if(unsynced >= HISTORY_SYNC_LINES || time(NULL) - last_sync >= HISTORY_SYNC_SECS) history_sync() ;
+    }
+    flock(hist_fd, LOCK_UN) ;
+}
+
+// Other sessions' entries are taken in first, so this one lands after them.
 void history_add_if_needed(shell_state *st, const char *cmd) {
     if(is_blank(cmd)) return  ;
     if(contains_atomic_log(cmd)) return ;
-    if(st -> log_count > 0 && !strcmp(st -> log[st -> log_count - 1], cmd)) return ;
-    if(st -> log_count == LOG_SIZE) {
-        for(int i = 0 ; i + 1 < LOG_SIZE ; i++) {
-            strcpy(st -> log[i], st -> log[i + 1]) ;
-        }
-        st -> log_count-- ;
-    }
-    strcpy(st -> log[st -> log_count++], cmd) ;
-    history_save(st) ;
-}
\ No newline at end of file
+    const char *last = history_get(st, 1) ;
+    if(last && !strcmp(last, cmd)) return ;
+    history_append(&st -> hist, cmd) ;
+    store_push(&st -> hist, cmd, strlen(cmd)) ;
+}
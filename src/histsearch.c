@@ -0,0 +1,500 @@
+#include "../include/posix_lib.h"
+#include "../include/histsearch.h"
+#include "../include/history.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Reverse-incremental search. Every entry gets an id in the order it was
+// added, the oldest 0, so its back number is next_id - id. Ids are grouped
+// into blocks of HISTSEARCH_BLOCK, and every unigram, bigram and trigram maps
+// to the set of blocks that hold an entry containing it. A search walks the
+// smallest set among the pattern's grams from the newest block back, skips
+// blocks missing from any other set, and strstr()s the entries of the rest.
+//
+// A set starts as a sorted array of block numbers and turns into a bitmap
+// over all blocks once that is smaller, which most sets for common grams do;
+// history repeats itself enough that the index stays a fraction of the text.
+//
+// Sets at block granularity cannot tell "31337" from a block that merely
+// has 313, 133 and 337 in different entries, which with numbers in history
+// is most blocks. So each block also keeps a SIG_BITS-bit signature of the
+// hashes of its 4-grams, and a block whose signature lacks one of the
+// pattern's 4-grams is skipped without touching its entries.
+//
+// The index is built while the shell waits for keys: histsearch_idle() first
+// walks history_get() back to count the entries, then indexes them oldest
+// first, a slice at a time. Entries added meanwhile only take an id and are
+// reached by the same walk. A search before it is done finishes it at once.
+//
+// Autosuggestions look entries up by prefix instead, in a radix tree built
+// from the same stream of ids. Each node holds the newest id anywhere below
+// it, and ids only ever arrive in increasing order, so adding an entry just
+// stamps its id on every node along its path. A lookup is a walk down the
+// prefix, whatever the size of the history. Edge labels are copied into one
+// growing block of bytes, since the ring frees entries as they are evicted.
+//
+// The ring evicts oldest first, so a node whose newest id has left the ring
+// has nothing live anywhere below it. Once as many ids again as the ring
+// holds have gone in, an idle slice copies only the live part of the tree
+// into fresh arrays, folding away the splits that gone entries needed, so
+// the tree stays within about twice what the ring holds.
+
+#define HISTSEARCH_BLOCK 256
+#define IDLE_COUNT_STEP  20000      // lines counted per idle slice
+#define IDLE_INDEX_STEP  1024       // entries indexed per idle slice
+
+// Printable ASCII gets a symbol each and every other byte shares the last
+// one, which only lets through more candidates for strstr() to turn down.
+// That makes the gram space small enough to index directly.
+#define GRAM_SYMS  96
+#define GRAM_SLOTS (GRAM_SYMS + GRAM_SYMS * GRAM_SYMS + GRAM_SYMS * GRAM_SYMS * GRAM_SYMS)
+
+#define SIG_BITS  8192
+#define SIG_WORDS (SIG_BITS / 64)
+
+typedef struct {
+    uint32_t n;             // blocks in the set
+    uint32_t cap;           // of blocks, or of words once a bitmap
+    uint32_t last;          // newest block added
+    uint32_t *blocks;       // sorted, or NULL once a bitmap
+    uint64_t *words;
+} gram_set;
+
+typedef struct {
+    uint32_t child, sibling;    // 0 for none; node 0 is the root
+    uint32_t label, len;        // the edge into this node, in labels
+    uint32_t newest;            // id
+    char first;                 // labels[label], kept here for the sibling walk
+} prefix_node;
+
+typedef enum { IDX_NONE, IDX_COUNTING, IDX_BUILDING, IDX_DONE } idx_state;
+
+static uint32_t *slots = NULL;      // per gram: index into sets + 1, or 0
+static gram_set *sets = NULL;
+static size_t n_sets = 0, sets_cap = 0;
+static uint64_t (*sigs)[SIG_WORDS] = NULL;     // per block
+static size_t sigs_cap = 0;
+
+static prefix_node *nodes = NULL;
+static size_t n_nodes = 0, nodes_cap = 0;
+static char *labels = NULL;
+static size_t labels_len = 0, labels_cap = 0;
+static size_t compacted = 0;        // next_id at the last compaction
+
+static idx_state state = IDX_NONE;
+static size_t counted = 0;          // entries known to exist while counting
+static size_t next_id = 0;
+static size_t build_id = 0;         // ids below this are indexed
+
+static uint32_t sym(char c) {
+    unsigned char u = c;
+    return u >= 32 && u < 127 ? u - 32 : GRAM_SYMS - 1;
+}
+
+// Slot of the n-gram (n = 1, 2 or 3) at s.
+static uint32_t gram_slot(const char *s, size_t n) {
+    if(n == 1) return sym(s[0]);
+    if(n == 2) return GRAM_SYMS + sym(s[0]) * GRAM_SYMS + sym(s[1]);
+    return GRAM_SYMS + GRAM_SYMS * GRAM_SYMS +
+           (sym(s[0]) * GRAM_SYMS + sym(s[1])) * GRAM_SYMS + sym(s[2]);
+}
+
+static uint32_t sig_bit(const char *s) {
+    uint32_t v;
+    memcpy(&v, s, 4);
+    return (v * 2654435761u) >> (32 - 13);
+}
+
+static gram_set *lookup(uint32_t slot) {
+    if(!slots || !slots[slot]) return NULL;
+    return &sets[slots[slot] - 1];
+}
+
+static int grow_words(gram_set *g, uint32_t block) {
+    if(block / 64 < g -> cap) return 0;
+
+    uint32_t cap = g -> cap ? g -> cap : 1;
+    while(cap <= block / 64) cap *= 2;
+    uint64_t *w = realloc(g -> words, cap * sizeof(*w));
+    if(!w) return -1;
+    memset(w + g -> cap, 0, (cap - g -> cap) * sizeof(*w));
+    g -> words = w;
+    g -> cap = cap;
+    return 0;
+}
+
+static void to_bitmap(gram_set *g) {
+    uint32_t *blocks = g -> blocks;
+    uint32_t n = g -> n, cap = g -> cap;
+
+    g -> cap = 0;
+    if(grow_words(g, g -> last) < 0) {
+        g -> cap = cap;
+        return;
+    }
+    for(uint32_t i = 0 ; i < n ; i++) g -> words[blocks[i] / 64] |= (uint64_t) 1 << (blocks[i] % 64);
+    g -> blocks = NULL;
+    free(blocks);
+}
+
+static void add_block(uint32_t slot, uint32_t block) {
+    gram_set *g;
+
+    if(slots[slot]) {
+        g = &sets[slots[slot] - 1];
+        if(g -> n && g -> last == block) return;
+    }
+    else {
+        if(n_sets == sets_cap) {
+            size_t cap = sets_cap ? sets_cap * 2 : 1024;
+            gram_set *s = realloc(sets, cap * sizeof(*s));
+            if(!s) return;
+            sets = s;
+            sets_cap = cap;
+        }
+        g = &sets[n_sets++];
+        memset(g, 0, sizeof(*g));
+        slots[slot] = n_sets;
+    }
+
+    if(!g -> blocks && g -> words) {
+        if(grow_words(g, block) < 0) return;
+        g -> words[block / 64] |= (uint64_t) 1 << (block % 64);
+    }
+    else {
+        if(g -> n == g -> cap) {
+            uint32_t cap = g -> cap ? g -> cap * 2 : 4;
+            uint32_t *b = realloc(g -> blocks, cap * sizeof(*b));
+            if(!b) return;
+            g -> blocks = b;
+            g -> cap = cap;
+        }
+        g -> blocks[g -> n] = block;
+    }
+    g -> n++;
+    g -> last = block;
+    // a bitmap over blocks 0..block costs block / 8 bytes, the array 4 n
+    if(g -> blocks && (size_t) g -> n * 32 > block) to_bitmap(g);
+}
+
+static uint64_t *block_sig(uint32_t block) {
+    if(block >= sigs_cap) {
+        size_t cap = sigs_cap ? sigs_cap * 2 : 64;
+        while(cap <= block) cap *= 2;
+        uint64_t (*s)[SIG_WORDS] = realloc(sigs, cap * sizeof(*s));
+        if(!s) return NULL;
+        memset(s + sigs_cap, 0, (cap - sigs_cap) * sizeof(*s));
+        sigs = s;
+        sigs_cap = cap;
+    }
+    return sigs[block];
+}
+
+static int add_label(const char *s, size_t n) {
+    if(labels_len + n > labels_cap) {
+        size_t cap = labels_cap ? labels_cap * 2 : 65536;
+        while(cap < labels_len + n) cap *= 2;
+        char *l = realloc(labels, cap);
+        if(!l) return -1;
+        labels = l;
+        labels_cap = cap;
+    }
+    memcpy(labels + labels_len, s, n);
+    labels_len += n;
+    return 0;
+}
+
+// A node whose edge is the n bytes at s, or 0 if there is no memory.
+static uint32_t new_node(const char *s, size_t n, uint32_t id) {
+    if(n_nodes == nodes_cap) {
+        size_t cap = nodes_cap ? nodes_cap * 2 : 1024;
+        prefix_node *p = realloc(nodes, cap * sizeof(*p));
+        if(!p) return 0;
+        nodes = p;
+        nodes_cap = cap;
+    }
+    uint32_t label = labels_len;
+    if(add_label(s, n) < 0) return 0;
+    nodes[n_nodes] = (prefix_node) { 0, 0, label, n, id, n ? s[0] : 0 };
+    return n_nodes++;
+}
+
+// The first m bytes of k's edge stay with k, the rest go to a new child
+// that takes over k's children.
+static int split(uint32_t k, uint32_t m) {
+    uint32_t c = new_node("", 0, nodes[k].newest);
+    if(!c) return -1;
+    nodes[c].label = nodes[k].label + m;
+    nodes[c].len = nodes[k].len - m;
+    nodes[c].first = labels[nodes[c].label];
+    nodes[c].child = nodes[k].child;
+    nodes[k].child = c;
+    nodes[k].len = m;
+    return 0;
+}
+
+static uint32_t find_child(uint32_t at, char c) {
+    uint32_t k = nodes[at].child;
+    while(k && nodes[k].first != c) k = nodes[k].sibling;
+    return k;
+}
+
+static void prefix_add(size_t id, const char *s) {
+    uint32_t at = 0;
+
+    // the root's index is 0 whether or not it could be made
+    if(!n_nodes) new_node("", 0, id);
+    if(!n_nodes) return;
+    nodes[0].newest = id;
+    while(*s) {
+        uint32_t k = find_child(at, *s);
+        if(!k) {
+            k = new_node(s, strlen(s), id);
+            if(!k) return;
+            nodes[k].sibling = nodes[at].child;
+            nodes[at].child = k;
+            return;
+        }
+        uint32_t m = 1;
+        while(m < nodes[k].len && s[m] == labels[nodes[k].label + m]) m++;
+        if(m < nodes[k].len && split(k, m) < 0) return;
+        nodes[k].newest = id;
+        s += m;
+        at = k;
+    }
+}
+
+// The child of k with an id of at least low, if it is the only one.
+static uint32_t only_live_child(const prefix_node *from, uint32_t k, size_t low) {
+    uint32_t only = 0;
+    for(uint32_t c = from[k].child ; c ; c = from[c].sibling) {
+        if(from[c].newest < low) continue;
+        if(only) return 0;
+        only = c;
+    }
+    return only;
+}
+
+static uint32_t copy_live(const prefix_node *from, const char *from_labels, uint32_t k, size_t low);
+
+static void copy_children(const prefix_node *from, const char *from_labels, uint32_t k,
+                          uint32_t to, size_t low) {
+    uint32_t last = 0;
+    for(uint32_t c = from[k].child ; c ; c = from[c].sibling) {
+        if(from[c].newest < low) continue;
+        uint32_t n = copy_live(from, from_labels, c, low);
+        if(!n) return;
+        if(last) nodes[last].sibling = n;
+        else nodes[to].child = n;
+        last = n;
+    }
+}
+
+// Copies node k of the old tree and its live subtree. A single live child
+// with the same newest id joins k's edge: whatever entry ended at k is older
+// than it and would never be suggested again. Returns 0 on no memory.
+static uint32_t copy_live(const prefix_node *from, const char *from_labels, uint32_t k, size_t low) {
+    uint32_t n = new_node(from_labels + from[k].label, from[k].len, from[k].newest), only;
+    if(!n) return 0;
+    while((only = only_live_child(from, k, low)) && from[only].newest == from[k].newest) {
+        if(add_label(from_labels + from[only].label, from[only].len) < 0) return 0;
+        nodes[n].len += from[only].len;
+        k = only;
+    }
+    copy_children(from, from_labels, k, n, low);
+    return n;
+}
+
+// Rebuilds the tree from the nodes with an id of at least low.
+static void prefix_compact(size_t low) {
+    prefix_node *from = nodes;
+    char *from_labels = labels;
+
+    nodes = NULL;
+    labels = NULL;
+    n_nodes = nodes_cap = labels_len = labels_cap = 0;
+    if(from && from[0].newest >= low && new_node("", 0, from[0].newest) == 0 && n_nodes)
+        copy_children(from, from_labels, 0, 0, low);
+    free(from);
+    free(from_labels);
+}
+
+static void add_entry(size_t id, const char *text) {
+    uint32_t block = id / HISTSEARCH_BLOCK;
+    uint64_t *sig = block_sig(block);
+
+    prefix_add(id, text);
+
+    for(const char *p = text ; *p ; p++) {
+        add_block(gram_slot(p, 1), block);
+        if(!p[1]) break;
+        add_block(gram_slot(p, 2), block);
+        if(!p[2]) continue;
+        add_block(gram_slot(p, 3), block);
+        if(p[3] && sig) {
+            uint32_t bit = sig_bit(p);
+            sig[bit / 64] |= (uint64_t) 1 << (bit % 64);
+        }
+    }
+}
+
+// One slice of the build. Returns 0 once the index is complete.
+static int build_step(shell_state *st) {
+    if(state == IDX_NONE) {
+        slots = calloc(GRAM_SLOTS, sizeof(*slots));
+        state = slots ? IDX_COUNTING : IDX_DONE;
+        if(!slots) return 0;
+    }
+    if(state == IDX_COUNTING) {
+        if(history_get(st, counted + IDLE_COUNT_STEP)) {
+            counted += IDLE_COUNT_STEP;
+            return 1;
+        }
+        next_id = history_count(st);
+        state = IDX_BUILDING;
+    }
+    if(state == IDX_BUILDING) {
+        for(int i = 0 ; i < IDLE_INDEX_STEP && build_id < next_id ; i++, build_id++) {
+            const char *e = history_get(st, next_id - build_id);
+            if(e) add_entry(build_id, e);
+        }
+        if(build_id < next_id) return 1;
+        state = IDX_DONE;
+    }
+    return 0;
+}
+
+int histsearch_idle(shell_state *st) {
+    size_t cap = st -> hist.cap;
+
+    if(state != IDX_DONE) return build_step(st);
+    if(cap && next_id - compacted > cap) {
+        prefix_compact(next_id - cap);
+        compacted = next_id;
+    }
+    return 0;
+}
+
+void histsearch_add(const char *text) {
+    if(state == IDX_DONE && slots) add_entry(next_id, text);
+    // counting has yet to see it, or the build walk will come to it
+    if(state >= IDX_BUILDING) next_id++;
+}
+
+// Newest block in g no newer than block, or -1.
+static long prev_block(const gram_set *g, long block) {
+    if(block < 0) return -1;
+    if(g -> blocks) {
+        size_t lo = 0, hi = g -> n;
+        while(lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if(g -> blocks[mid] <= block) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo ? (long) g -> blocks[lo - 1] : -1;
+    }
+    if((size_t) block / 64 >= g -> cap) block = (long) g -> cap * 64 - 1;
+    for( ; block >= 0 ; block--) {
+        uint64_t w = g -> words[block / 64];
+        if(!w) {
+            block -= block % 64;
+            continue;
+        }
+        if(w >> (block % 64) & 1) return block;
+    }
+    return -1;
+}
+
+static int has_block(const gram_set *g, uint32_t block) {
+    if(g -> blocks) return prev_block(g, block) == (long) block;
+    return block / 64 < g -> cap && (g -> words[block / 64] >> (block % 64) & 1);
+}
+
+static int sig_has(uint32_t block, const uint32_t *bits, size_t n_bits) {
+    if(block >= sigs_cap) return 1;
+    for(size_t i = 0 ; i < n_bits ; i++) {
+        if(!(sigs[block][bits[i] / 64] >> (bits[i] % 64) & 1)) return 0;
+    }
+    return 1;
+}
+
+static size_t search_blocks(shell_state *st, const char *pat, const gram_set **grams,
+                            size_t n_grams, const uint32_t *bits, size_t n_bits,
+                            size_t from) {
+    const gram_set *rarest = NULL;
+    for(size_t i = 0 ; i < n_grams ; i++) {
+        if(!grams[i]) return 0;
+        if(!rarest || grams[i] -> n < rarest -> n) rarest = grams[i];
+    }
+
+    size_t newest = next_id - from;
+    long block = newest / HISTSEARCH_BLOCK;
+    for( ; (block = prev_block(rarest, block)) >= 0 ; block--) {
+        if(!sig_has(block, bits, n_bits)) continue;
+        size_t k;
+        for(k = 0 ; k < n_grams && (grams[k] == rarest || has_block(grams[k], block)) ; k++) {}
+        if(k < n_grams) continue;
+
+        size_t first = (size_t) block * HISTSEARCH_BLOCK;
+        size_t id = first + HISTSEARCH_BLOCK - 1;
+        if(id > newest) id = newest;
+        for( ; ; id--) {
+            const char *e = history_get(st, next_id - id);
+            // evicted, and so is everything older
+            if(!e) return 0;
+            if(strstr(e, pat)) return next_id - id;
+            if(id == first) break;
+        }
+    }
+    return 0;
+}
+
+// Patterns of three bytes or more are looked up by their trigrams, shorter
+// ones by their single bigram or unigram.
+size_t histsearch_find(shell_state *st, const char *pat, size_t from) {
+    while(build_step(st)) {}
+    if(from == 0) from = 1;
+    if(state != IDX_DONE || from > next_id || !*pat) return 0;
+
+    size_t len = strlen(pat);
+    size_t n = len < 3 ? len : 3;
+    size_t n_grams = len - n + 1;
+    size_t n_bits = len < 4 ? 0 : len - 3;
+    const gram_set **grams = malloc(n_grams * sizeof(*grams));
+    uint32_t *bits = malloc((n_bits + 1) * sizeof(*bits));
+    size_t found = 0;
+
+    if(grams && bits) {
+        for(size_t i = 0 ; i < n_grams ; i++) grams[i] = lookup(gram_slot(pat + i, n));
+        for(size_t i = 0 ; i < n_bits ; i++) bits[i] = sig_bit(pat + i);
+        found = search_blocks(st, pat, grams, n_grams, bits, n_bits, from);
+    }
+    free(grams);
+    free(bits);
+    return found;
+}
+
+// Entries that only match the prefix exactly are no suggestion, so a walk
+// that ends on a node looks at the newest among its children instead.
+const char *histsearch_suggest(shell_state *st, const char *prefix, size_t n) {
+    uint32_t at = 0, m = 0;
+
+    if(state != IDX_DONE || !n_nodes || n == 0) return NULL;
+    for(size_t i = 0 ; i < n ; ) {
+        at = find_child(at, prefix[i]);
+        if(!at) return NULL;
+        for(m = 0 ; m < nodes[at].len && i < n ; m++, i++) {
+            if(labels[nodes[at].label + m] != prefix[i]) return NULL;
+        }
+    }
+
+    long id = -1;
+    if(m < nodes[at].len) id = nodes[at].newest;
+    for(uint32_t k = nodes[at].child ; k && m == nodes[at].len ; k = nodes[k].sibling) {
+        if((long) nodes[k].newest > id) id = nodes[k].newest;
+    }
+    // evicted from the ring, or not yet indexed
+    return id < 0 ? NULL : history_get(st, next_id - id);
+}
@@ -1,103 +1,883 @@
+#define _GNU_SOURCE
+
 #include "../include/input.h"
 #include "../include/shell.h"
+#include "../include/jobs.h"
+#include "../include/history.h"
+#include "../include/histsearch.h"
+#include "../include/complete.h"
+#include "../include/prompt.h"
+#include "../include/signals.h"
 
 #include <termios.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+// The line editor reads the terminal in blocks and decodes keys from its own
+// buffer, so a paste costs one read() per block rather than one per byte.
+// Nothing is drawn while decoded input is still waiting: each burst of keys
+// ends in one write() of the whole redraw, built in `out`. Typing at the end
+// of the line sends just the new bytes; anything else redraws from the start
+// of the prompt, which may span several terminal rows.
+//
+// Input left over after Enter stays buffered for the next line, so a pasted
+// run of commands executes one line at a time. Terminals that support
+// bracketed paste mark pastes instead, and those go into the line whole,
+// newlines and all, to run only once Enter is pressed; main.c then runs the
+// lines in order. A line of the buffer after a newline is drawn behind
+// CONT_PROMPT.
+//
+// Tab completes the word before the cursor (complete.c). If what it needs
+// is still being read, the Tab waits while fill() lets complete_idle() read
+// it between keys, and is pressed again once it is all there, unless
+// another key came first.
+
+#define INPUT_BLOCK    4096
+#define ESC_TIMEOUT_MS 50      // a lone ESC if nothing follows it by then
+#define CONT_PROMPT    "> "
+#define TAB_STOP       8
+
+#define PASTE_ON  "\033[?2004h"
+#define PASTE_OFF "\033[?2004l"
+#define PASTE_END "\033[201~"
+
+#define GHOST_ON  "\033[90m"
+#define GHOST_OFF "\033[m"
+
+enum {
+    KEY_NONE = 0,
+    KEY_CTRL_A = 1, KEY_CTRL_B = 2, KEY_CTRL_D = 4, KEY_CTRL_E = 5,
+    KEY_CTRL_F = 6, KEY_CTRL_G = 7, KEY_BACKSPACE = 8, KEY_TAB = 9, KEY_CTRL_K = 11,
+    KEY_CTRL_L = 12, KEY_ENTER = 13, KEY_CTRL_N = 14, KEY_CTRL_P = 16,
+    KEY_CTRL_R = 18, KEY_CTRL_U = 21, KEY_CTRL_W = 23, KEY_CTRL_Y = 25,
+    KEY_ESC = 27, KEY_DEL = 127,
+    KEY_UP = 256, KEY_DOWN, KEY_LEFT, KEY_RIGHT, KEY_HOME, KEY_END,
+    KEY_DELETE, KEY_WORD_LEFT, KEY_WORD_RIGHT, KEY_KILL_WORD, KEY_RUBOUT_WORD,
+    KEY_PASTE,
+};
 
 static struct termios orig_termios;
 static int raw_mode = 0;
 
+// TCSADRAIN rather than TCSAFLUSH: keys typed while a command ran are
+// still in the tty's queue and belong to the next prompt. Bracketed paste
+// is only on while psh reads a line, so commands never see the markers.
 void input_enable_raw(void) {
     if (raw_mode) return;
     tcgetattr(STDIN_FILENO, &orig_termios);
     struct termios raw = orig_termios;
     raw.c_lflag &= ~(ECHO | ICANON);
+    raw.c_iflag &= ~ICRNL;      // so a pasted CRLF is told from two newlines
     raw.c_cc[VMIN] = 1;
     raw.c_cc[VTIME] = 0;
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+    write(STDOUT_FILENO, PASTE_ON, sizeof(PASTE_ON) - 1);
     raw_mode = 1;
 }
 
 void input_disable_raw(void) {
     if (!raw_mode) return;
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+    write(STDOUT_FILENO, PASTE_OFF, sizeof(PASTE_OFF) - 1);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &orig_termios);
     raw_mode = 0;
 }
 
-char *input_read_line(shell_state *st) {
-    static char buf[2048];
-    int pos = 0;
-    int hist_idx = st->log_count;
+static char *buf = NULL;
+static size_t buf_cap = 0;
 
-    input_enable_raw();
+static char inbuf[INPUT_BLOCK];
+static size_t in_pos = 0, in_len = 0;
 
-    while (1) {
-        char c;
-        if (read(STDIN_FILENO, &c, 1) <= 0) {
-            input_disable_raw();
-            return NULL;
-        }
+static char *out = NULL;
+static size_t out_len = 0, out_cap = 0;
 
-        if (c == '\r' || c == '\n') {
-            write(STDOUT_FILENO, "\n", 1);
+static char *kill_buf = NULL;
+static size_t kill_len = 0, kill_cap = 0;
+
+static void *grow(void *p, size_t *cap, size_t need) {
+    if (need < *cap) return p;
+
+    size_t ncap = *cap ? *cap : 256;
+    while (ncap <= need) ncap *= 2;
+    char *tmp = realloc(p, ncap);
+    if (!tmp) {
+        perror("realloc");
+        exit(1);
+    }
+    *cap = ncap;
+    return tmp;
+}
+
+// The line buffer only ever grows, so a pasted line of any length fits.
+static void ensure_cap(size_t n) {
+    buf = grow(buf, &buf_cap, n);
+}
+
+static void out_add(const char *s, size_t n) {
+    out = grow(out, &out_cap, out_len + n);
+    memcpy(out + out_len, s, n);
+    out_len += n;
+}
+
+static void out_addf(const char *fmt, ...) {
+    char tmp[64];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n > 0) out_add(tmp, n < (int)sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+}
+
+static void out_flush(void) {
+    size_t done = 0;
+    while (done < out_len) {
+        ssize_t w = write(STDOUT_FILENO, out + done, out_len - done);
+        if (w < 0) {
+            if (errno == EINTR) continue;
             break;
+        }
+        done += w;
+    }
+    out_len = 0;
+}
+
+static int is_cont(char c) {
+    return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+typedef struct {
+    shell_state *st;
+    char prompt[PROMPT_MAX];
+    size_t prompt_len;
+    size_t len, cur;        // of buf
+    int cols;               // terminal width
+    int row, col;           // cursor, from the prompt's first row, as drawn
+    long drawn;             // buf[0, drawn) is on screen, cursor after it; -1 if not
+    int ghost;              // a suggestion is shown after the cursor
+    int tab_pending;        // Tabs waiting for complete_idle(), 2 for a double
+    int last_key;
+} editor;
+
+static void set_prompt(editor *e, const char *p) {
+    size_t n = strlen(p);
+    if (n >= sizeof(e -> prompt)) n = sizeof(e -> prompt) - 1;
+    memcpy(e -> prompt, p, n);
+    e -> prompt[n] = '\0';
+    e -> prompt_len = n;
+    e -> drawn = -1;
+}
 
-        } else if (c == 127 || c == 8) {  
-            if (pos > 0) {
-                pos--;
-                write(STDOUT_FILENO, "\b \b", 3);
+static int term_cols(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+    return 80;
+}
+
+// Moves *row and *col past the n bytes at s, one column per UTF-8 code
+// point. A character in the last column leaves *col == cols, the terminal's
+// pending wrap: the cursor stays on that row until the next one is printed.
+static void walk(const editor *e, const char *s, size_t n, int *row, int *col) {
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\n') {
+            ++*row;
+            *col = sizeof(CONT_PROMPT) - 1;
+            continue;
+        }
+        if (is_cont(s[i])) continue;
+        int w = s[i] == '\t' ? TAB_STOP - *col % TAB_STOP : 1;
+        while (w-- > 0) {
+            if (*col == e -> cols) {
+                ++*row;
+                *col = 0;
             }
+            ++*col;
+        }
+    }
+}
+
+// Prints the n bytes at s from the cursor, which is at *row, *col.
+// Newlines start a row behind CONT_PROMPT and tabs become spaces, so every
+// byte sent is one walk() counted.
+static void draw(editor *e, const char *s, size_t n, int *row, int *col) {
+    static const char spaces[TAB_STOP] = "        ";
+    const char *end = s + n;
+
+    while (s < end) {
+        size_t k = 0;
+        while (s + k < end && s[k] != '\n' && s[k] != '\t') k++;
+        out_add(s, k);
+        walk(e, s, k, row, col);
+        s += k;
+        if (s == end) break;
+
+        if (*s == '\n') {
+            out_add("\r\n" CONT_PROMPT, sizeof(CONT_PROMPT) + 1);
+        }
+        else {
+            int c = *col == e -> cols ? 0 : *col;
+            out_add(spaces, TAB_STOP - c % TAB_STOP);
+        }
+        walk(e, s, 1, row, col);
+        s++;
+    }
+}
+
+// Ends a draw out of the pending wrap, so the row below exists for the
+// cursor to be put on.
+static void unwrap(editor *e) {
+    if (e -> col < e -> cols) return;
+    out_add("\r\n", 2);
+    e -> row++;
+    e -> col = 0;
+}
+
+// Moves from the cursor back to the start of the prompt and clears below.
+static void out_home(editor *e) {
+    if (e -> row > 0) out_addf("\033[%dA", e -> row);
+    out_add("\r\033[J", 4);
+    e -> row = e -> col = 0;
+    e -> ghost = 0;
+}
 
-        } else if (c == 4) { 
-            if (pos == 0) {
-                input_disable_raw();
-                return NULL;
+// Draws prompt and line from scratch and puts the cursor back at cur.
+static void refresh(editor *e) {
+    e -> cols = term_cols();
+    out_home(e);
+    out_add(e -> prompt, e -> prompt_len);
+    walk(e, e -> prompt, e -> prompt_len, &e -> row, &e -> col);
+    draw(e, buf, e -> len, &e -> row, &e -> col);
+    unwrap(e);
+
+    int row = 0, col = 0;
+    walk(e, e -> prompt, e -> prompt_len, &row, &col);
+    walk(e, buf, e -> cur, &row, &col);
+    if (col == e -> cols) {
+        row++;
+        col = 0;
+    }
+    if (e -> row > row) out_addf("\033[%dA", e -> row - row);
+    out_add("\r", 1);
+    if (col) out_addf("\033[%dC", col);
+    e -> row = row;
+    e -> col = col;
+    e -> drawn = e -> cur == e -> len ? (long)e -> len : -1;
+}
+
+// The rest of the newest history entry the line is a prefix of, shown
+// dimmed after the cursor while it is at the end of the line. The cursor
+// is put back at the end of the line, so everything past it is the ghost.
+static const char *suggestion(const editor *e) {
+    if (e -> cur < e -> len) return NULL;
+    const char *s = histsearch_suggest(e -> st, buf, e -> len);
+    return s ? s + e -> len : NULL;
+}
+
+static void show_ghost(editor *e) {
+    const char *s = suggestion(e);
+    int row = e -> row, col = e -> col;
+
+    if (!s) return;
+    out_add(GHOST_ON, sizeof(GHOST_ON) - 1);
+    draw(e, s, strlen(s), &row, &col);
+    out_add(GHOST_OFF, sizeof(GHOST_OFF) - 1);
+    if (row > e -> row) out_addf("\033[%dA", row - e -> row);
+    out_add("\r", 1);
+    if (e -> col) out_addf("\033[%dC", e -> col);
+    e -> ghost = 1;
+}
+
+// Brings the screen up to date unless more input is already waiting.
+static void update(editor *e) {
+    if (in_pos < in_len) return;
+
+    if (e -> drawn >= 0 && e -> cur == e -> len && (size_t)e -> drawn <= e -> len) {
+        if (e -> ghost) out_add("\033[J", 3);
+        draw(e, buf + e -> drawn, e -> len - e -> drawn, &e -> row, &e -> col);
+        unwrap(e);
+        e -> drawn = e -> len;
+    }
+    else {
+        refresh(e);
+    }
+    show_ghost(e);
+    out_flush();
+}
+
+// Refills inbuf. With timeout_ms >= 0 only what arrives within that long
+// counts, and -2 means nothing did. Otherwise blocks, reaping any child that
+// changes state meanwhile: its notice is printed over the line being edited,
+// which is then drawn again below it. While idle, slices of the history
+// search index and of what a Tab waits for are built; a waiting Tab is put
+// back into inbuf once it can be answered. A wait also ends when unsynced
+// history is due for its fdatasync(). Returns 1, 0 on EOF, or -1 if ^C cancelled the line.
+//
+// SIGINT is blocked except inside ppoll(), so a ^C that lands while a line
+// is being drawn is not left waiting for the next key.
+static int fill(editor *e, int timeout_ms, const sigset_t *wait_mask) {
+    struct pollfd fds[2] = {
+        { .fd = STDIN_FILENO, .events = POLLIN },
+        { .fd = signals_chld_fd(), .events = POLLIN },
+    };
+    int nfds = timeout_ms < 0 && fds[1].fd >= 0 ? 2 : 1;
+    int idle = timeout_ms < 0;
+    struct timespec ts = { timeout_ms / 1000, timeout_ms % 1000 * 1000000L }, zero = { 0, 0 };
+
+    for (;;) {
+        if (signals_take_interrupt()) return -1;
+        int due = timeout_ms < 0 && !idle ? history_sync_due() : -1;
+        struct timespec sync = { due / 1000, due % 1000 * 1000000L };
+        int ready = ppoll(fds, nfds, idle ? &zero : timeout_ms >= 0 ? &ts : due >= 0 ? &sync : NULL, wait_mask);
+        if (ready == 0) {
+            if (due >= 0) {
+                history_sync();
+                continue;
             }
+            if (!idle) return -2;
+            // the search index is built while nothing else is going on
+            int more = complete_idle();
+            if (e -> tab_pending && !more) {
+                e -> last_key = e -> tab_pending > 1 ? KEY_TAB : KEY_NONE;
+                e -> tab_pending = 0;
+                inbuf[0] = KEY_TAB;
+                in_pos = 0;
+                in_len = 1;
+                return 1;
+            }
+            idle = more || histsearch_idle(e -> st);
+            continue;
+        }
+        if (ready < 0) {
+            if (errno != EINTR) return 0;
+            continue;
+        }
+        if (nfds == 2 && (fds[1].revents & POLLIN) && signals_drain_chld()) {
+            out_home(e);
+            out_flush();
+            jobs_check(e -> st);
+            e -> drawn = -1;
+            update(e);
+        }
+        if (fds[0].revents) {
+            ssize_t n;
+            while ((n = read(STDIN_FILENO, inbuf, sizeof(inbuf))) < 0 && errno == EINTR) {}
+            if (n <= 0) return 0;
+            in_pos = 0;
+            in_len = n;
+            return 1;
+        }
+    }
+}
+
+static int refill(editor *e, int timeout_ms) {
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    int got = fill(e, timeout_ms, &old);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return got;
+}
+
+// Next input byte, waiting as fill() does.
+static int next_byte(editor *e, int timeout_ms, unsigned char *c) {
+    if (in_pos == in_len) {
+        int got = refill(e, timeout_ms);
+        if (got != 1) return got;
+    }
+    *c = inbuf[in_pos++];
+    return 1;
+}
+
+// ESC [ params final, after the ESC [.
+static int decode_csi(editor *e) {
+    char params[16];
+    size_t n = 0;
+    unsigned char c;
+
+    for (;;) {
+        if (next_byte(e, ESC_TIMEOUT_MS, &c) != 1) return KEY_NONE;
+        if (c >= 0x40 && c <= 0x7E) break;
+        if (n + 1 < sizeof(params)) params[n++] = c;
+    }
+    params[n] = '\0';
+
+    // ;3 is Alt and ;5 Ctrl on the arrows
+    int mod = !strcmp(params, "1;3") || !strcmp(params, "1;5");
+    switch (c) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return mod ? KEY_WORD_RIGHT : KEY_RIGHT;
+        case 'D': return mod ? KEY_WORD_LEFT : KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        case '~':
+            if (!strcmp(params, "1") || !strcmp(params, "7")) return KEY_HOME;
+            if (!strcmp(params, "4") || !strcmp(params, "8")) return KEY_END;
+            if (!strcmp(params, "3")) return KEY_DELETE;
+            if (!strcmp(params, "200")) return KEY_PASTE;
+    }
+    return KEY_NONE;
+}
+
+// After an ESC: a CSI or SS3 sequence, an Alt chord, or a lone ESC.
+static int decode_esc(editor *e) {
+    unsigned char c;
+    int got = next_byte(e, ESC_TIMEOUT_MS, &c);
+    if (got == -2) return KEY_ESC;
+    if (got != 1) return KEY_NONE;
 
-        } else if (c == 27) {  
-            char seq[2];
-            read(STDIN_FILENO, &seq[0], 1);
-            read(STDIN_FILENO, &seq[1], 1);
-
-            if (seq[0] == '[') {
-                if (seq[1] == 'A') {  
-                    if (hist_idx > 0) {
-                        hist_idx--;
-                        while (pos > 0) { write(STDOUT_FILENO, "\b \b", 3); pos--; }
-                        const char *entry = st->log[hist_idx];
-                        write(STDOUT_FILENO, entry, strlen(entry));
-                        strncpy(buf, entry, sizeof(buf) - 1);
-                        pos = strlen(entry);
-                    }
-
-                } else if (seq[1] == 'B') {  
-                    if (hist_idx < st->log_count - 1) {
-                        hist_idx++;
-                        while (pos > 0) { write(STDOUT_FILENO, "\b \b", 3); pos--; }
-                        const char *entry = st->log[hist_idx];
-                        write(STDOUT_FILENO, entry, strlen(entry));
-                        strncpy(buf, entry, sizeof(buf) - 1);
-                        pos = strlen(entry);
-                    } else {
-                        hist_idx = st->log_count;
-                        while (pos > 0) { write(STDOUT_FILENO, "\b \b", 3); pos--; }
-                        pos = 0;
-                    }
-                }
+    switch (c) {
+        case '[': return decode_csi(e);
+        case 'O':
+            if (next_byte(e, ESC_TIMEOUT_MS, &c) != 1) return KEY_NONE;
+            switch (c) {
+                case 'A': return KEY_UP;
+                case 'B': return KEY_DOWN;
+                case 'C': return KEY_RIGHT;
+                case 'D': return KEY_LEFT;
+                case 'H': return KEY_HOME;
+                case 'F': return KEY_END;
             }
+            return KEY_NONE;
+        case 'b': return KEY_WORD_LEFT;
+        case 'f': return KEY_WORD_RIGHT;
+        case 'd': return KEY_KILL_WORD;
+        case 127: return KEY_RUBOUT_WORD;
+    }
+    return KEY_NONE;
+}
+
+// Returns as next_byte() does, with the decoded key in *key.
+static int read_key(editor *e, int *key) {
+    unsigned char c;
+    int got = next_byte(e, -1, &c);
+    if (got != 1) return got;
+
+    *key = c == KEY_ESC ? decode_esc(e) : c;
+    return 1;
+}
+
+static void insert(editor *e, const char *s, size_t n) {
+    ensure_cap(e -> len + n);
+    if (e -> cur < e -> len) {
+        memmove(buf + e -> cur + n, buf + e -> cur, e -> len - e -> cur);
+        e -> drawn = -1;
+    }
+    memcpy(buf + e -> cur, s, n);
+    e -> len += n;
+    e -> cur += n;
+}
+
+// Removes buf[from, to), saving it for ^Y if kill is set.
+static void cut(editor *e, size_t from, size_t to, int kill) {
+    if (from >= to) return;
+    if (kill) {
+        kill_buf = grow(kill_buf, &kill_cap, to - from);
+        memcpy(kill_buf, buf + from, to - from);
+        kill_len = to - from;
+    }
+    memmove(buf + from, buf + to, e -> len - to);
+    e -> len -= to - from;
+    e -> cur = from;
+    e -> drawn = -1;
+}
+
+static size_t char_left(size_t i) {
+    while (i > 0 && is_cont(buf[--i])) {}
+    return i;
+}
+
+static size_t char_right(const editor *e, size_t i) {
+    if (i < e -> len) i++;
+    while (i < e -> len && is_cont(buf[i])) i++;
+    return i;
+}
+
+static int is_word(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (unsigned char)c >= 0x80;
+}
+
+static size_t word_left(size_t i) {
+    while (i > 0 && !is_word(buf[i - 1])) i--;
+    while (i > 0 && is_word(buf[i - 1])) i--;
+    return i;
+}
+
+static size_t word_right(const editor *e, size_t i) {
+    while (i < e -> len && !is_word(buf[i])) i++;
+    while (i < e -> len && is_word(buf[i])) i++;
+    return i;
+}
+
+static void set_line(editor *e, const char *s) {
+    size_t n = strlen(s);
+    ensure_cap(n);
+    memcpy(buf, s, n);
+    e -> len = e -> cur = n;
+    e -> drawn = -1;
+}
+
+static void move_to(editor *e, size_t i) {
+    if (i != e -> cur) e -> drawn = -1;
+    e -> cur = i;
+}
+
+// Puts the suggestion on the line. Returns 0 if there is none.
+static int accept(editor *e) {
+    const char *s = suggestion(e);
+    if (!s) return 0;
+    insert(e, s, strlen(s));
+    return 1;
+}
+
+// Ctrl-R. Each character typed moves to the newest entry, from the current
+// match back, that contains the pattern; Ctrl-R again steps to the next
+// older one. ^G puts the line back as it was. Any other key leaves the
+// match on the line and is handed back in *key to be handled as usual, so
+// Enter runs it. Returns as read_key() does.
+static int reverse_search(editor *e, int *key) {
+    char *orig = strndup(buf, e -> len);
+    char *pat = NULL;
+    size_t plen = 0, pcap = 0, match = 0;
+    int failed = 0, got;
+
+    for (;;) {
+        if (in_pos == in_len) {
+            char label[PROMPT_MAX];
+            snprintf(label, sizeof(label), "(%sreverse-i-search)`%.*s': ",
+                     failed ? "failed " : "", (int)plen, pat ? pat : "");
+            set_prompt(e, label);
+            refresh(e);
+            out_flush();
+        }
+
+        got = read_key(e, key);
+        if (got <= 0) break;
+
+        size_t from = match ? match : 1;
+        if (*key == KEY_CTRL_R) {
+            if (!match) continue;
+            from = match + 1;
+        } else if (*key == KEY_DEL || *key == KEY_BACKSPACE) {
+            while (plen > 0 && is_cont(pat[--plen])) {}
+            from = 1;
+        } else if (*key == KEY_CTRL_G) {
+            if (orig) set_line(e, orig);
+            *key = KEY_NONE;
+            break;
+        } else if (*key >= 32 && *key < 256) {
+            pat = grow(pat, &pcap, plen + 1);
+            pat[plen++] = *key;
+            // the rest of a UTF-8 character comes before searching
+            if (in_pos < in_len && is_cont(inbuf[in_pos])) continue;
+        } else {
+            break;
+        }
 
-        } else if (c >= 32) {  
-            if (pos < (int)sizeof(buf) - 1) {
-                buf[pos++] = c;
-                write(STDOUT_FILENO, &c, 1);
+        if (plen == 0) {
+            match = 0;
+            failed = 0;
+            if (orig) set_line(e, orig);
+            continue;
+        }
+        pat[plen] = '\0';
+        size_t m = histsearch_find(e -> st, pat, from);
+        failed = m == 0;
+        if (m) {
+            match = m;
+            set_line(e, history_get(e -> st, m));
+        }
+    }
+
+    free(orig);
+    free(pat);
+    return got;
+}
+
+static void clear_screen(editor *e) {
+    out_add("\033[H\033[2J", 7);
+    e -> row = e -> col = e -> ghost = 0;
+    e -> drawn = -1;
+}
+
+// A bracketed paste, after its ESC [200~. Everything up to PASTE_END is
+// filtered straight from inbuf into the line at the cursor: CR and CRLF
+// become newlines, tabs are kept and other control bytes dropped, so
+// nothing pasted is taken as a key. Returns 1, or as refill() does if the
+// input ends or ^C comes first.
+static int paste(editor *e) {
+    static const char end[] = PASTE_END;
+    size_t matched = 0, tail_len = e -> len - e -> cur, tail_cap = 0;
+    char *tail = NULL;
+    int got = 1, cr = 0;
+
+    // the text after the cursor waits aside while the paste is appended
+    if (tail_len) {
+        tail = grow(NULL, &tail_cap, tail_len);
+        memcpy(tail, buf + e -> cur, tail_len);
+        e -> len = e -> cur;
+        e -> drawn = -1;
+    }
+    while (matched < sizeof(end) - 1) {
+        if (in_pos == in_len && (got = refill(e, -1)) != 1) break;
+
+        // the bytes kept are never more than the bytes read, plus what
+        // a broken-off match gives back
+        ensure_cap(e -> len + (in_len - in_pos) + sizeof(end));
+        char *d = buf + e -> len;
+        while (in_pos < in_len && matched < sizeof(end) - 1) {
+            char c = inbuf[in_pos++];
+            if (c == end[matched]) {
+                matched++;
+                continue;
+            }
+            if (matched) {
+                // a false start: its ESC is dropped like any control byte
+                memcpy(d, end + 1, matched - 1);
+                d += matched - 1;
+                matched = c == end[0];
+                if (matched) continue;
             }
+            if (c == '\n' && cr) {
+                cr = 0;
+                continue;
+            }
+            cr = c == '\r';
+            if (cr) c = '\n';
+            if ((unsigned char)c >= 32 ? c != KEY_DEL : c == '\n' || c == '\t') *d++ = c;
+        }
+        e -> len = d - buf;
+    }
+    e -> cur = e -> len;
+    if (tail) {
+        ensure_cap(e -> len + tail_len);
+        memcpy(buf + e -> len, tail, tail_len);
+        e -> len += tail_len;
+        free(tail);
+    }
+    return got;
+}
+
+// Lists the matches in columns below the line, which is drawn again under
+// them.
+static void show_matches(editor *e, const completion *c) {
+    size_t cur = e -> cur, width = 0;
+
+    e -> cur = e -> len;
+    refresh(e);
+    out_add("\r\n", 2);
+    for (size_t i = 0; i < c -> n_list; i++) {
+        size_t w = 0;
+        for (const char *p = c -> list[i]; *p; p++) w += !is_cont(*p);
+        if (w > width) width = w;
+    }
+    width += 2;
+    size_t per_row = (size_t)e -> cols / width ? (size_t)e -> cols / width : 1;
+    size_t rows = (c -> n_list + per_row - 1) / per_row;
+    for (size_t r = 0; r < rows; r++) {
+        for (size_t k = 0; k < per_row && k * rows + r < c -> n_list; k++) {
+            const char *name = c -> list[k * rows + r];
+            size_t w = 0;
+            for (const char *p = name; *p; p++) w += !is_cont(*p);
+            out_add(name, strlen(name));
+            if (k + 1 < per_row && (k + 1) * rows + r < c -> n_list) out_addf("%*s", (int)(width - w), "");
+        }
+        out_add("\r\n", 2);
+    }
+    if (c -> n > c -> n_list) out_addf("(%zu more)\r\n", c -> n - c -> n_list);
+    e -> row = e -> col = 0;
+    e -> drawn = -1;
+    e -> cur = cur;
+}
+
+// Inserts what completes the word before the cursor. A second Tab in a row
+// that adds nothing lists the matches instead.
+static void complete(editor *e) {
+    completion c;
+
+    if (complete_word(buf, e -> cur, &c) < 0) e -> tab_pending = e -> last_key == KEY_TAB ? 2 : 1;
+    if (c.insert) insert(e, c.insert, strlen(c.insert));
+    else if (c.n > 1 && e -> last_key == KEY_TAB) show_matches(e, &c);
+    complete_free(&c);
+}
+
+// Inserts the key, and with it the rest of a run of plain characters that
+// is already buffered, so a paste is copied in a block at a time.
+static void insert_run(editor *e, char c) {
+    size_t n = 0;
+    while (in_pos + n < in_len && (unsigned char)inbuf[in_pos + n] >= 32 && inbuf[in_pos + n] != KEY_DEL) n++;
+
+    insert(e, &c, 1);
+    insert(e, inbuf + in_pos, n);
+    in_pos += n;
+}
+
+// Moves to the next (dir > 0) or previous entry in history. The line being
+// typed is kept aside while browsing and comes back past the newest entry.
+static void browse(editor *e, size_t *back, char **fresh, int dir) {
+    if (dir > 0) {
+        if (!history_get(e -> st, *back + 1)) return;
+        if (*back == 0) {
+            free(*fresh);
+            *fresh = strndup(buf, e -> len);
         }
+        ++*back;
+    }
+    else {
+        if (*back == 0) return;
+        --*back;
+    }
+    set_line(e, *back ? history_get(e -> st, *back) : *fresh ? *fresh : "");
+}
+
+// Applies one key. Returns 1 once the line is complete, -1 at EOF, else 0.
+static int edit(editor *e, int key, size_t *back, char **fresh) {
+    size_t i;
+
+    switch (key) {
+        case KEY_ENTER:
+        case '\n':
+            move_to(e, e -> len);
+            return 1;
+        case KEY_CTRL_D:
+            if (e -> len == 0) return -1;
+            cut(e, e -> cur, char_right(e, e -> cur), 0);
+            break;
+        case KEY_DEL:
+        case KEY_BACKSPACE:
+            cut(e, char_left(e -> cur), e -> cur, 0);
+            break;
+        case KEY_DELETE:
+            cut(e, e -> cur, char_right(e, e -> cur), 0);
+            break;
+        case KEY_LEFT:
+        case KEY_CTRL_B:
+            move_to(e, char_left(e -> cur));
+            break;
+        case KEY_RIGHT:
+        case KEY_CTRL_F:
+            if (!accept(e)) move_to(e, char_right(e, e -> cur));
+            break;
+        case KEY_HOME:
+        case KEY_CTRL_A:
+            move_to(e, 0);
+            break;
+        case KEY_END:
+        case KEY_CTRL_E:
+            if (!accept(e)) move_to(e, e -> len);
+            break;
+        case KEY_WORD_LEFT:
+            move_to(e, word_left(e -> cur));
+            break;
+        case KEY_WORD_RIGHT:
+            move_to(e, word_right(e, e -> cur));
+            break;
+        case KEY_CTRL_K:
+            cut(e, e -> cur, e -> len, 1);
+            break;
+        case KEY_CTRL_U:
+            cut(e, 0, e -> cur, 1);
+            break;
+        case KEY_CTRL_W:
+            // back to the previous space, as readline's unix-word-rubout
+            for (i = e -> cur; i > 0 && buf[i - 1] == ' '; i--) {}
+            for ( ; i > 0 && buf[i - 1] != ' '; i--) {}
+            cut(e, i, e -> cur, 1);
+            break;
+        case KEY_KILL_WORD:
+            cut(e, e -> cur, word_right(e, e -> cur), 1);
+            break;
+        case KEY_RUBOUT_WORD:
+            cut(e, word_left(e -> cur), e -> cur, 1);
+            break;
+        case KEY_CTRL_Y:
+            if (kill_len) insert(e, kill_buf, kill_len);
+            break;
+        case KEY_CTRL_L:
+            clear_screen(e);
+            break;
+        case KEY_TAB:
+            complete(e);
+            break;
+        case KEY_UP:
+        case KEY_CTRL_P:
+            browse(e, back, fresh, 1);
+            break;
+        case KEY_DOWN:
+        case KEY_CTRL_N:
+            browse(e, back, fresh, -1);
+            break;
+        default:
+            if (key >= 32 && key < 256 && key != KEY_DEL) insert_run(e, key);
     }
+    return 0;
+}
+
+char *input_read_line(shell_state *st) {
+    editor ed = { .st = st };
+    editor *e = &ed;
+    size_t back = 0;        // history entry on the line, 0 for a fresh one
+    char *fresh = NULL;
+    char prompt[PROMPT_MAX];
+    int done = 0;
+
+    // the caller has just printed the prompt
+    prompt_format(st, prompt, sizeof(prompt));
+    set_prompt(e, prompt);
+    e -> cols = term_cols();
+    walk(e, e -> prompt, e -> prompt_len, &e -> row, &e -> col);
+    e -> drawn = 0;
 
+    input_enable_raw();
+    ensure_cap(0);
+
+    while (!done) {
+        int key = KEY_NONE;
+        int got = read_key(e, &key);
+        if (got > 0 && key == KEY_CTRL_R) {
+            got = reverse_search(e, &key);
+            set_prompt(e, prompt);
+        }
+        if (got > 0 && key == KEY_PASTE) {
+            got = paste(e);
+            key = KEY_NONE;
+        }
+        if (got < 0) {
+            e -> cur = e -> len;
+            refresh(e);
+            out_add("^C\n", 3);
+            e -> len = 0;
+            break;
+        }
+        if (key != KEY_TAB) e -> tab_pending = 0;
+        done = got == 0 ? -1 : edit(e, key, &back, &fresh);
+        e -> last_key = key;
+        if (done <= 0) {
+            update(e);
+            continue;
+        }
+
+        // leave the cursor below the whole line
+        if (e -> drawn != (long)e -> len) refresh(e);
+        else if (e -> ghost) out_add("\033[J", 3);
+        if (e -> col > 0) out_add("\n", 1);
+    }
+    out_flush();
+    free(fresh);
     input_disable_raw();
-    buf[pos] = '\0';
+    if (done < 0) return NULL;
+
+    ensure_cap(e -> len);
+    buf[e -> len] = '\0';
     return buf;
-}
\ No newline at end of file
+}
@@ -1,81 +1,751 @@
-
+#define _DEFAULT_SOURCE
 #include "../include/posix_lib.h"
 #include "../include/shell.h" 
 #include "../include/jobs.h"
 
 #include<stdio.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 #include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
 
+#include "../include/signals.h"
+#include "../include/helpers.h"
+#include "../include/jobstat.h"
+#include "../include/timing.h"
+#include "../include/limit.h"
 
-void jobs_init(shell_state *st) {
-    st -> next_job_id = 1 ;
-    for(int i = 0 ; i < MAX_JOBS ; i++) {
-        st -> jobs[i].active = 0 ;
+extern shell_state global_shell_state ;
+
+// Jobs live in a growable list. Every member pid and every group leader is
+// also a key in an open-addressing index, so a reaped pid finds its job in
+// one probe however many jobs are running.
+
+#define EMPTY_KEY 0
+#define TOMBSTONE -1
+
+static void *xrealloc(void *p, size_t n) {
+    p = realloc(p, n) ;
+    if(!p) {
+        perror("realloc") ;
+        exit(1) ;
+    }
+    return p ;
+}
+
+static size_t pid_slot(pid_t pid, size_t cap) {
+    return ((unsigned) pid * 2654435761u) & (cap - 1) ;
+}
+
+static void index_put(pid_index *ix, pid_t pid, job *j) ;
+
+// Rehashes into a table sized for the live keys, which also drops tombstones.
+static void index_grow(pid_index *ix) {
+    pid_index old = *ix ;
+    size_t live = 0 ;
+    for(size_t i = 0 ; i < old.cap ; i++) live += old.keys[i] > 0 ;
+
+    size_t cap = 64 ;
+    while(cap < (live + 1) * 2) cap *= 2 ;
+
+    ix -> keys = calloc(cap, sizeof(pid_t)) ;
+    ix -> vals = calloc(cap, sizeof(job *)) ;
+    if(!ix -> keys || !ix -> vals) {
+        perror("calloc") ;
+        exit(1) ;
+    }
+    ix -> cap = cap ;
+    ix -> used = 0 ;
+    for(size_t i = 0 ; i < old.cap ; i++) {
+        if(old.keys[i] > 0) index_put(ix, old.keys[i], old.vals[i]) ;
+    }
+    free(old.keys) ;
+    free(old.vals) ;
+}
+
+static size_t index_find(const pid_index *ix, pid_t pid) ;
+
+static void index_put(pid_index *ix, pid_t pid, job *j) {
+    size_t i = index_find(ix, pid) ;
+    if(i != (size_t) -1) {
+        ix -> vals[i] = j ;
+        return ;
     }
+    if((ix -> used + 1) * 4 > ix -> cap * 3) index_grow(ix) ;
+
+    i = pid_slot(pid, ix -> cap) ;
+    while(ix -> keys[i] > 0 && ix -> keys[i] != pid) i = (i + 1) & (ix -> cap - 1) ;
+    if(ix -> keys[i] == EMPTY_KEY) ix -> used++ ;
+    ix -> keys[i] = pid ;
+    ix -> vals[i] = j ;
+}
+
+static size_t index_find(const pid_index *ix, pid_t pid) {
+    if(!ix -> cap) return (size_t) -1 ;
+
+    for(size_t i = pid_slot(pid, ix -> cap) ; ix -> keys[i] != EMPTY_KEY ; i = (i + 1) & (ix -> cap - 1)) {
+        if(ix -> keys[i] == pid) return i ;
+    }
+    return (size_t) -1 ;
+}
+
+static job *index_get(const pid_index *ix, pid_t pid) {
+    size_t i = index_find(ix, pid) ;
+    return i == (size_t) -1 ? NULL : ix -> vals[i] ;
+}
+
+static void index_del(pid_index *ix, pid_t pid) {
+    size_t i = index_find(ix, pid) ;
+    if(i == (size_t) -1) return ;
+    ix -> keys[i] = TOMBSTONE ;
+    ix -> vals[i] = NULL ;
+}
+
+// Job names are interned: a build farm that starts the same command hundreds
+// of times keeps one refcounted copy of its text.
+typedef struct interned {
+    struct interned *next ;
+    unsigned hash ;
+    unsigned refs ;
+    char text[] ;
+} interned ;
+
+static interned **strs = NULL ;
+static size_t strs_cap = 0, strs_n = 0 ;
+
+static unsigned hash_str(const char *s) {
+    unsigned h = 5381 ;
+    for( ; *s ; s++) h = h * 33 + (unsigned char) *s ;
+    return h ;
+}
+
+static const char *intern(const char *s) {
+    unsigned h = hash_str(s) ;
+
+    if(strs_cap) {
+        for(interned *e = strs[h & (strs_cap - 1)] ; e ; e = e -> next) {
+            if(e -> hash == h && !strcmp(e -> text, s)) {
+                e -> refs++ ;
+                return e -> text ;
+            }
+        }
+    }
+    if(strs_n >= strs_cap) {
+        size_t cap = strs_cap ? strs_cap * 2 : 64 ;
+        interned **tab = calloc(cap, sizeof(*tab)) ;
+        if(!tab) {
+            perror("calloc") ;
+            exit(1) ;
+        }
+        for(size_t i = 0 ; i < strs_cap ; i++) {
+            for(interned *e = strs[i], *next ; e ; e = next) {
+                next = e -> next ;
+                e -> next = tab[e -> hash & (cap - 1)] ;
+                tab[e -> hash & (cap - 1)] = e ;
+            }
+        }
+        free(strs) ;
+        strs = tab ;
+        strs_cap = cap ;
+    }
+    size_t len = strlen(s) ;
+    interned *e = xrealloc(NULL, sizeof(*e) + len + 1) ;
+    memcpy(e -> text, s, len + 1) ;
+    e -> hash = h ;
+    e -> refs = 1 ;
+    e -> next = strs[h & (strs_cap - 1)] ;
+    strs[h & (strs_cap - 1)] = e ;
+    strs_n++ ;
+    return e -> text ;
+}
+
+static void release(const char *text) {
+    interned *e = (interned *)(text - offsetof(interned, text)) ;
+    if(--e -> refs) return ;
+
+    for(interned **p = &strs[e -> hash & (strs_cap - 1)] ; *p ; p = &(*p) -> next) {
+        if(*p == e) {
+            *p = e -> next ;
+            break ;
+        }
+    }
+    strs_n-- ;
+    free(e) ;
+}
+
+void jobs_init(shell_state *st) {
+    memset(&st -> jobs, 0, sizeof(st -> jobs)) ;
+    st -> jobs.next_id = 1 ;
 }
+
 static const char *name_of(const char *s) {
     return s ? s : "";
 }
 
-int jobs_add(shell_state *st, pid_t pid, char *cmd) {
-    for(int i = 0; i < MAX_JOBS; i++) {
-        if(st->jobs[i].active) continue;
+// pgid is 0 for jobs started without job control; pids are the members
+// still running, in pipeline order.
+job *jobs_add(shell_state *st, pid_t pgid, const pid_t *pids, int n, const char *cmd, job_state state) {
+    job_table *t = &st -> jobs ;
+    job *j = xrealloc(NULL, sizeof(*j)) ;
+
+    j -> id = t -> next_id++ ;
+    j -> pgid = pgid ;
+    j -> cmd = intern(name_of(cmd)) ;
+    j -> state = state ;
+    j -> procs = xrealloc(NULL, (n ? n : 1) * sizeof(job_proc)) ;
+    clock_gettime(CLOCK_MONOTONIC, &j -> start) ;
+    j -> end = j -> prev_at = j -> start ;
+    j -> prev_cpu = 0 ;
+    j -> limits = NULL ;
+    memset(&j -> live, 0, sizeof(j -> live)) ;
+    j -> n_procs = j -> n_live = n ;
+    for(int i = 0 ; i < n ; i++) {
+        j -> procs[i] = (job_proc) { .pid = pids[i], .stopped = (state == JOB_STOPPED) } ;
+        index_put(&t -> by_pid, pids[i], j) ;
+    }
+    if(pgid > 0) index_put(&t -> by_pgid, pgid, j) ;
+
+    if(t -> n == t -> cap) {
+        t -> cap = t -> cap ? t -> cap * 2 : 16 ;
+        t -> list = xrealloc(t -> list, t -> cap * sizeof(job *)) ;
+    }
+    j -> slot = t -> n ;
+    t -> list[t -> n++] = j ;
+    return j ;
+}
+
+job *jobs_by_pid(shell_state *st, pid_t pid) {
+    return index_get(&st -> jobs.by_pid, pid) ;
+}
+
+job *jobs_by_pgid(shell_state *st, pid_t pgid) {
+    return index_get(&st -> jobs.by_pgid, pgid) ;
+}
+
+void jobs_remove(shell_state *st, job *j) {
+    job_table *t = &st -> jobs ;
+
+    for(int i = 0 ; i < j -> n_procs ; i++) {
+        if(!j -> procs[i].exited) index_del(&t -> by_pid, j -> procs[i].pid) ;
+    }
+    if(j -> pgid > 0) index_del(&t -> by_pgid, j -> pgid) ;
+
+    t -> list[j -> slot] = t -> list[--t -> n] ;
+    t -> list[j -> slot] -> slot = j -> slot ;
+    if(t -> n == 0) t -> next_id = 1 ;
+
+    if(j -> limits) limit_close(j -> limits, j -> cmd) ;
+    release(j -> cmd) ;
+    free(j -> procs) ;
+    free(j) ;
+}
 
-        st->jobs[i].active = 1;
-        st->jobs[i].pid    = pid;
-        st->jobs[i].pgid   = pid;   // pgid = pid since each job is its own group leader
-        st->jobs[i].state  = JOB_RUNNING;
-        st->jobs[i].id     = st->next_job_id++;
+void jobs_signal(job *j, int sig) {
+    if(j -> pgid > 0) {
+        kill(-j -> pgid, sig) ;
+        return ;
+    }
+    for(int i = 0 ; i < j -> n_procs ; i++) {
+        if(!j -> procs[i].exited) kill(j -> procs[i].pid, sig) ;
+    }
+}
 
-        strncpy(st->jobs[i].cmd, cmd, sizeof(st->jobs[i].cmd) - 1);
-        st->jobs[i].cmd[sizeof(st->jobs[i].cmd) - 1] = '\0';
+// At logout every job is killed and reaped, which also removes the
+// cgroups of limited ones.
+void jobs_kill_all(shell_state *st) {
+    int status, live = 0 ;
+    job *j ;
 
-        return st->jobs[i].id;
+    for(int i = 0 ; i < st -> jobs.n ; i++) {
+        jobs_signal(st -> jobs.list[i], SIGKILL) ;
+        live += st -> jobs.list[i] -> n_live ;
     }
-    fprintf(stderr, "Maximum number of background jobs reached.\n");
-    return -1;
+    while(live > 0) {
+        pid_t pid = jobs_wait(st, -1, &status, 0, &j) ;
+        if(pid < 0 && errno == EINTR) continue ;
+        if(pid < 0) break ;
+        if(j) live-- ;
+    }
+    while(st -> jobs.n) jobs_remove(st, st -> jobs.list[0]) ;
+}
+
+// When the shell exits without logging out (`exit`, the end of a script) its
+// jobs are left running, but not their cgroups: limit_close() kills what is
+// still in one.
+void jobs_close_limits(shell_state *st) {
+    for(int i = 0 ; i < st -> jobs.n ; i++) {
+        job *j = st -> jobs.list[i] ;
+        if(!j -> limits) continue ;
+        limit_close(j -> limits, j -> cmd) ;
+        j -> limits = NULL ;
+    }
+}
+
+static void report_done(const job *j) {
+    int status = j -> procs[j -> n_procs - 1].status ;
+    int pid = j -> pgid > 0 ? j -> pgid : j -> procs[0].pid ;
+
+    if(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        printf("%s with pid %d exited normally", j -> cmd, pid) ;
+    }
+    else if(WIFEXITED(status)) {
+        printf("%s with pid %d exited abnormally", j -> cmd, pid) ;
+    }
+    // true means the child process was terminated abnormally due to another signal (e.g., SIGKILL, SIGSEGV, etc.)
+    else {
+        printf("%s with pid %d was terminated by a signal", j -> cmd, pid) ;
+    }
+
+    job_usage u ;
+    char rss[16], rd[16], wr[16] ;
+    jobstat_total(j, &u) ;
+    printf(" (%.1fs elapsed, %.2fs cpu, %s max rss, %s read, %s written)\n",
+           timing_elapsed(&j -> start, &j -> end), u.cpu,
+           jobstat_size(rss, sizeof(rss), (unsigned long long) u.rss_kb * 1024),
+           jobstat_size(rd, sizeof(rd), u.rchar), jobstat_size(wr, sizeof(wr), u.wchar)) ;
+    fflush(stdout) ;
+}
+
+static void update_state(job *j) {
+    if(j -> n_live == 0) {
+        j -> state = JOB_DONE ;
+        return ;
+    }
+    int stopped = 0 ;
+    for(int i = 0 ; i < j -> n_procs ; i++) stopped += j -> procs[i].stopped ;
+    j -> state = (j -> n_live && stopped == j -> n_live) ? JOB_STOPPED : JOB_RUNNING ;
+}
+
+static job_proc *find_proc(job *j, pid_t pid) {
+    for(int i = 0 ; i < j -> n_procs ; i++) {
+        if(j -> procs[i].pid == pid && !j -> procs[i].exited) return &j -> procs[i] ;
+    }
+    return NULL ;
+}
+
+// Files one wait result under its job, with the member's rusage if ru is
+// set. Returns the job, which is finished once n_live drops to 0, or NULL
+// for a pid no job owns.
+job *jobs_reap(shell_state *st, pid_t pid, int status, const struct rusage *ru) {
+    job *j = jobs_by_pid(st, pid) ;
+    if(!j) return NULL ;
+
+    job_proc *p = find_proc(j, pid) ;
+    if(!p) return NULL ;
+
+    if(WIFSTOPPED(status)) {
+        p -> stopped = 1 ;
+    }
+    else if(WIFCONTINUED(status)) {
+        p -> stopped = 0 ;
+    }
+    else {
+        p -> exited = 1 ;
+        p -> stopped = 0 ;
+        p -> status = status ;
+        if(ru) jobstat_exited(p, ru) ;
+        if(--j -> n_live == 0) clock_gettime(CLOCK_MONOTONIC, &j -> end) ;
+        index_del(&st -> jobs.by_pid, pid) ;
+    }
+    update_state(j) ;
+    return j ;
+}
+
+// waitpid() for the job table. An exit is first peeked at with WNOWAIT, so
+// the member's io counters can still be read from its zombie, and is then
+// reaped with wait4() for its rusage. *jp is the job, as from jobs_reap().
+pid_t jobs_wait(shell_state *st, pid_t which, int *status, int options, job **jp) {
+    idtype_t type = which < -1 ? P_PGID : which == -1 ? P_ALL : P_PID ;
+    id_t id = which < -1 ? (id_t) -which : which == -1 ? 0 : (id_t) which ;
+    int flags = WEXITED | WNOWAIT | (options & (WNOHANG | WCONTINUED)) ;
+    if(options & WUNTRACED) flags |= WSTOPPED ;
+
+    siginfo_t si ;
+    memset(&si, 0, sizeof(si)) ;
+    *jp = NULL ;
+    if(waitid(type, id, &si, flags) < 0) return -1 ;
+    if(si.si_pid == 0) return 0 ;
+
+    job *j = jobs_by_pid(st, si.si_pid) ;
+    job_proc *p = j ? find_proc(j, si.si_pid) : NULL ;
+    if(p && (si.si_code == CLD_EXITED || si.si_code == CLD_KILLED || si.si_code == CLD_DUMPED)) {
+        jobstat_read_io(si.si_pid, &p -> use) ;
+    }
+
+    struct rusage ru ;
+    pid_t pid ;
+    while((pid = wait4(si.si_pid, status, options, &ru)) < 0 && errno == EINTR) {}
+    if(pid > 0) *jp = jobs_reap(st, pid, *status, &ru) ;
+    return pid ;
+}
+
+int jobs_status(const job *j) {
+    return wait_status_code(j -> procs[j -> n_procs - 1].status) ;
+}
+
+// Interactively a finished job is announced and dropped. A script may still
+// `wait` for it, so there it stays in the table as JOB_DONE with its status
+// until wait or jobs consumes it; only its cgroup goes now.
+void jobs_finish(shell_state *st, job *j) {
+    if(!st -> job_control) {
+        if(j -> limits) limit_close(j -> limits, j -> cmd) ;
+        j -> limits = NULL ;
+        return ;
+    }
+    report_done(j) ;
+    jobs_remove(st, j) ;
 }
 
 void jobs_check(shell_state *st) {
     int status ;
     pid_t rpid ;
 
-    while((rpid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-        int idx = -1 ;
-        for(int i = 0 ; i < MAX_JOBS ; i++) {
-            if(st -> jobs[i].active && st -> jobs[i].pid == rpid) {
-                idx = i ; break ;
-            }
+    job *j ;
+
+    while((rpid = jobs_wait(st, -1, &status, WNOHANG | WUNTRACED | WCONTINUED, &j)) > 0) {
+        if(j && j -> n_live == 0) jobs_finish(st, j) ;
+    }
+}
+
+static job *first_done(shell_state *st) {
+    job *first = NULL ;
+    for(int i = 0 ; i < st -> jobs.n ; i++) {
+        job *j = st -> jobs.list[i] ;
+        if(j -> state == JOB_DONE && (!first || j -> id < first -> id)) first = j ;
+    }
+    return first ;
+}
+
+// The current job (%+, %%, or no argument) is the newest one.
+static job *current_job(shell_state *st) {
+    job *cur = NULL ;
+    for(int i = 0 ; i < st -> jobs.n ; i++) {
+        if(!cur || st -> jobs.list[i] -> id > cur -> id) cur = st -> jobs.list[i] ;
+    }
+    return cur ;
+}
+
+static job *job_by_id(shell_state *st, int id) {
+    for(int i = 0 ; i < st -> jobs.n ; i++) {
+        if(st -> jobs.list[i] -> id == id) return st -> jobs.list[i] ;
+    }
+    return NULL ;
+}
+
+// Accepts %N, %%, %+ and a bare N. Reports its own errors.
+static job *parse_spec(shell_state *st, const char *who, const char *arg) {
+    job *j = NULL ;
+
+    if(!arg || !strcmp(arg, "%%") || !strcmp(arg, "%+")) {
+        j = current_job(st) ;
+        if(!j) fprintf(stderr, "%s: no current job\n", who) ;
+        return j ;
+    }
+    const char *num = arg[0] == '%' ? arg + 1 : arg ;
+    char *end ;
+    long id = strtol(num, &end, 10) ;
+    if(*num && !*end) j = job_by_id(st, (int) id) ;
+    if(!j) fprintf(stderr, "%s: %s: no such job\n", who, arg) ;
+    return j ;
+}
+
+static void mark_running(job *j) {
+    for(int i = 0 ; i < j -> n_procs ; i++) j -> procs[i].stopped = 0 ;
+    j -> state = JOB_RUNNING ;
+}
+
+static const char *state_name(const job *j) {
+    return j -> state == JOB_STOPPED ? "Stopped" : j -> state == JOB_DONE ? "Done" : "Running" ;
+}
+
+// CPU% covers the time since the previous jobs -l, or the job's whole life
+// the first time; RSS is what the job's processes have resident now.
+static void print_usage(job *j, char mark, const struct timespec *now) {
+    job_usage u ;
+    char rss[16], rd[16], wr[16] ;
+
+    jobstat_total(j, &u) ;
+    const struct timespec *end = j -> state == JOB_DONE ? &j -> end : now ;
+    double span = timing_elapsed(&j -> prev_at, end) ;
+    double pct = span > 0 ? 100 * (u.cpu - j -> prev_cpu) / span : 0 ;
+    j -> prev_cpu = u.cpu ;
+    j -> prev_at = *end ;
+
+    int pid = j -> pgid > 0 ? j -> pgid : j -> procs[0].pid ;
+    printf("[%d]%c %-8s %7d %9.1fs %6.1f%% %8s %8s %8s  %s\n", j -> id, mark, state_name(j), pid,
+           timing_elapsed(&j -> start, end), pct,
+           jobstat_size(rss, sizeof(rss), (unsigned long long) u.rss_kb * 1024),
+           jobstat_size(rd, sizeof(rd), u.rchar), jobstat_size(wr, sizeof(wr), u.wchar), j -> cmd) ;
+}
+
+// jobs -l samples /proc for every running job before printing.
+int command_jobs(char **args) {
+    shell_state *st = &global_shell_state ;
+    int usage = args[1] && !strcmp(args[1], "-l") ;
+    struct timespec now ;
+
+    jobs_check(st) ;
+    if(usage) {
+        jobstat_sample(st) ;
+        clock_gettime(CLOCK_MONOTONIC, &now) ;
+        if(st -> jobs.n) printf("%-12s %7s %10s %7s %8s %8s %8s  %s\n",
+                                "job", "pid", "elapsed", "cpu", "rss", "read", "written", "command") ;
+    }
+
+    // the list is unordered, so print by id
+    job *cur = current_job(st) ;
+    int last = 0 ;
+    for(;;) {
+        job *next = NULL ;
+        for(int i = 0 ; i < st -> jobs.n ; i++) {
+            job *j = st -> jobs.list[i] ;
+            if(j -> id > last && (!next || j -> id < next -> id)) next = j ;
         }
-        if(idx == -1) continue ;
-        if(WIFSTOPPED(status)) {
-            st -> jobs[idx].state = JOB_STOPPED ; continue ;
+        if(!next) break ;
+        if(usage) print_usage(next, next == cur ? '+' : ' ', &now) ;
+        else printf("[%d]%c %-8s %s\n", next -> id, next == cur ? '+' : ' ', state_name(next), next -> cmd) ;
+        last = next -> id ;
+    }
+    job *done ;
+    while((done = first_done(st))) jobs_remove(st, done) ;
+    return 0 ;
+}
+
+// Continues the job in the foreground and waits for it the way
+// wait_foreground() waits for a fresh pipeline.
+int command_fg(char **args) {
+    shell_state *st = &global_shell_state ;
+
+    if(!st -> job_control) {
+        fprintf(stderr, "fg: no job control\n") ;
+        return 1 ;
+    }
+    job *j = parse_spec(st, "fg", args[1]) ;
+    if(!j) return 1 ;
+
+    pid_t pg = j -> pgid ;
+    int id = j -> id ;
+    printf("%s\n", j -> cmd) ;
+    fflush(stdout) ;
+
+    signals_set_fg_pgid(pg, j -> cmd) ;
+    tcsetpgrp(STDIN_FILENO, pg) ;
+    mark_running(j) ;
+    jobs_signal(j, SIGCONT) ;
+
+    int status = 0, ret = 0 ;
+    pid_t pid ;
+    job *r ;
+    while((pid = jobs_wait(st, -pg, &status, WUNTRACED, &r)) > 0) {
+        if(r != j) continue ;
+
+        if(j -> n_live == 0) {
+            ret = jobs_status(j) ;
+            jobs_remove(st, j) ;
+            break ;
         }
-        if(WIFCONTINUED(status)) {
-            st -> jobs[idx].state = JOB_RUNNING ; continue ;
+        if(j -> state == JOB_STOPPED) {
+            printf("[%d] Stopped %s with pid %d\n", id, j -> cmd, (int) pg) ;
+            ret = 128 + SIGTSTP ;
+            break ;
         }
-        if(WIFEXITED(status)) {
-            int code = WEXITSTATUS(status) ;
+    }
+    if(WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) {
+        write(STDOUT_FILENO, "\n", 1) ;
+    }
+    fflush(stdout) ;
+    tcsetpgrp(STDIN_FILENO, getpgrp()) ;
+    signals_set_fg_pgid(-1, NULL) ;
+    return ret ;
+}
+
+int command_bg(char **args) {
+    shell_state *st = &global_shell_state ;
+
+    job *j = parse_spec(st, "bg", args[1]) ;
+    if(!j) return 1 ;
+    if(j -> state == JOB_RUNNING) {
+        fprintf(stderr, "bg: job %d already in background\n", j -> id) ;
+        return 0 ;
+    }
+    mark_running(j) ;
+    jobs_signal(j, SIGCONT) ;
+    printf("[%d] %s &\n", j -> id, j -> cmd) ;
+    return 0 ;
+}
+
+static int listed(job *j, job **jobs, int n) {
+    for(int i = 0 ; i < n ; i++) {
+        if(jobs[i] == j) return 1 ;
+    }
+    return 0 ;
+}
+
+// Blocks in waitpid() until one of the n targets has finished or, with no
+// target, until any one job has (any_one) or none is left running. The
+// awaited jobs are not announced. Returns the awaited job's status, 0
+// once all are done, 148 if every target is stopped, and 130 when ^C gives
+// up.
+static int wait_jobs(shell_state *st, job **targets, int n, int any_one) {
+    job *done ;
+
+    for(int i = 0 ; i < n ; i++) {
+        if(targets[i] -> state == JOB_DONE) {
+            int ret = jobs_status(targets[i]) ;
+            jobs_remove(st, targets[i]) ;
+            return ret ;
+        }
+    }
+    if(!n && any_one && (done = first_done(st))) {
+        int ret = jobs_status(done) ;
+        jobs_remove(st, done) ;
+        return ret ;
+    }
+    if(!n && !any_one) {
+        while((done = first_done(st))) jobs_remove(st, done) ;
+    }
+
+    for(;;) {
+        int running = 0 ;
+        if(n) {
+            for(int i = 0 ; i < n ; i++) running += targets[i] -> state == JOB_RUNNING ;
+            if(!running) return 128 + SIGTSTP ;
+        }
+        else {
+            for(int i = 0 ; i < st -> jobs.n ; i++) running += st -> jobs.list[i] -> state == JOB_RUNNING ;
+            if(!running) return any_one ? 127 : 0 ;
+        }
+
+        int status ;
+        job *j ;
+        pid_t pid = jobs_wait(st, -1, &status, WUNTRACED | WCONTINUED, &j) ;
+        if(pid < 0) {
+            if(errno == EINTR && signals_take_interrupt()) return 130 ;
+            if(errno == EINTR) continue ;
+            return 127 ;
+        }
+        if(!j || j -> n_live) continue ;
+
+        // a job that was not asked for goes the way the prompt would take it
+        int hit = n ? listed(j, targets, n) : any_one ;
+        if(n && !hit) {
+            jobs_finish(st, j) ;
+            continue ;
+        }
+        int ret = jobs_status(j) ;
+        jobs_remove(st, j) ;
+        if(hit) return ret ;
+    }
+}
+
+// wait [-n] [%N | pid ...]: each listed job in turn, or with -n whichever
+// of them finishes first.
+int command_wait(char **args) {
+    shell_state *st = &global_shell_state ;
+    int any_one = 0 ;
+    int i = 1 ;
+
+    if(args[1] && !strcmp(args[1], "-n")) {
+        any_one = 1 ;
+        i++ ;
+    }
+    if(!args[i]) return wait_jobs(st, NULL, 0, any_one) ;
+
+    int n = 0 ;
+    while(args[i + n]) n++ ;
+    job **targets = xrealloc(NULL, n * sizeof(*targets)) ;
 
-            if(code == 0) {
-                printf("%s with pid %d exited normally\n",
-                       name_of(st -> jobs[idx].cmd), (int) st -> jobs[idx].pid);
+    int ret = 0 ;
+    n = 0 ;
+    for( ; args[i] ; i++) {
+        job *j ;
+        if(args[i][0] == '%') {
+            j = parse_spec(st, "wait", args[i]) ;
+            if(!j) {
+                ret = 127 ;
+                continue ;
             }
-            else {
-                printf("%s with pid %d exited abnormally\n",
-                       name_of(st -> jobs[idx].cmd), (int)st -> jobs[idx].pid);
+        }
+        else {
+            j = jobs_by_pid(st, (pid_t) atoi(args[i])) ;
+            if(!j) {
+                fprintf(stderr, "wait: pid %s is not a child of this shell\n", args[i]) ;
+                ret = 127 ;
+                continue ;
             }
-            fflush(stdout) ;
-            st -> jobs[idx].active = 0 ; continue ;
         }
-        // true means the child process was terminated abnormally due to another signal (e.g., SIGKILL, SIGSEGV, etc.)
-        if(WIFSIGNALED(status)) {
-            printf("%s with pid %d was terminated by a signal\n",
-                   name_of(st -> jobs[idx].cmd), (int) st -> jobs[idx].pid);
-            fflush(stdout) ;
-            st -> jobs[idx].active = 0 ;
+        if(any_one) targets[n++] = j ;
+        else ret = wait_jobs(st, &j, 1, 0) ;
+    }
+    if(any_one && n) ret = wait_jobs(st, targets, n, 1) ;
+    free(targets) ;
+    return ret ;
+}
+
+static const struct { const char *name ; int sig ; } sig_names[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+    { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "PIPE", SIGPIPE }, { "ALRM", SIGALRM },
+    { "TERM", SIGTERM }, { "CHLD", SIGCHLD }, { "CONT", SIGCONT }, { "STOP", SIGSTOP },
+    { "TSTP", SIGTSTP }, { "TTIN", SIGTTIN }, { "TTOU", SIGTTOU },
+};
+#define N_SIG_NAMES (int)(sizeof(sig_names) / sizeof(sig_names[0]))
+
+static int parse_signal(const char *s) {
+    if(isdigit((unsigned char) *s)) return atoi(s) ;
+    if(!strncmp(s, "SIG", 3)) s += 3 ;
+    for(int i = 0 ; i < N_SIG_NAMES ; i++) {
+        if(!strcmp(s, sig_names[i].name)) return sig_names[i].sig ;
+    }
+    return -1 ;
+}
+
+// kill [-s SIG | -SIG] %N|pid ...
+int command_kill(char **args) {
+    shell_state *st = &global_shell_state ;
+    int sig = SIGTERM ;
+    int i = 1 ;
+
+    if(args[1] && !strcmp(args[1], "-s") && args[2]) {
+        sig = parse_signal(args[2]) ;
+        i = 3 ;
+    }
+    else if(args[1] && args[1][0] == '-' && args[1][1]) {
+        sig = parse_signal(args[1] + 1) ;
+        i = 2 ;
+    }
+    if(sig < 0) {
+        fprintf(stderr, "kill: %s: invalid signal specification\n", args[i - 1]) ;
+        return 1 ;
+    }
+    if(!args[i]) {
+        fprintf(stderr, "Usage: kill [-s sig | -sig] %%job | pid ...\n") ;
+        return 1 ;
+    }
+
+    int ret = 0 ;
+    for( ; args[i] ; i++) {
+        if(args[i][0] == '%') {
+            job *j = parse_spec(st, "kill", args[i]) ;
+            if(!j) {
+                ret = 1 ;
+                continue ;
+            }
+            // a stopped job only acts on the signal once it runs again
+            jobs_signal(j, sig) ;
+            if(j -> state == JOB_STOPPED && sig != SIGCONT && sig != SIGKILL) jobs_signal(j, SIGCONT) ;
+            continue ;
+        }
+        char *end ;
+        long pid = strtol(args[i], &end, 10) ;
+        if(*end || end == args[i] || kill((pid_t) pid, sig) < 0) {
+            fprintf(stderr, "kill: %s: %s\n", args[i], *end || end == args[i] ? "arguments must be process or job IDs" : strerror(errno)) ;
+            ret = 1 ;
         }
     }
-}
\ No newline at end of file
+    return ret ;
+}
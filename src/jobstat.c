@@ -0,0 +1,167 @@
+#include "../include/posix_lib.h"
+#include "../include/jobstat.h"
+#include "../include/jobs.h"
+#include "../include/timing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+
+// Job accounting. A running job is measured from /proc: every process in its
+// group, or every member of a job without a group of its own, adds its stat
+// CPU time, its statm resident set and its io byte counts. A member that has
+// exited counts with its wait4() rusage instead, plus the io counts read from
+// its zombie just before the reap, so a finished job's totals are final.
+
+static long ticks = 0 ;
+static long page_kb = 0 ;
+
+static ssize_t read_proc(pid_t pid, const char *file, char *buf, size_t n) {
+    char path[64] ;
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int) pid, file) ;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC) ;
+    if(fd < 0) return -1 ;
+    ssize_t got = read(fd, buf, n - 1) ;
+    close(fd) ;
+    if(got < 0) return -1 ;
+    buf[got] = '\0' ;
+    return got ;
+}
+
+// CPU seconds of pid and the children it has reaped. Returns its process
+// group, or -1 once it is gone.
+static pid_t read_stat(pid_t pid, double *cpu) {
+    char buf[1024] ;
+    if(read_proc(pid, "stat", buf, sizeof(buf)) < 0) return -1 ;
+
+    // the command name may hold spaces and ')', so fields start after the last one
+    char *p = strrchr(buf, ')') ;
+    int pgrp ;
+    unsigned long ut, stime ;
+    long cut, cst ;
+    if(!p || sscanf(p + 2, "%*c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld",
+                    &pgrp, &ut, &stime, &cut, &cst) != 5) return -1 ;
+
+    if(!ticks) {
+        ticks = sysconf(_SC_CLK_TCK) ;
+        page_kb = sysconf(_SC_PAGESIZE) / 1024 ;
+    }
+    *cpu = (double) (ut + stime + cut + cst) / ticks ;
+    return pgrp ;
+}
+
+void jobstat_read_io(pid_t pid, job_usage *u) {
+    char buf[512] ;
+    if(read_proc(pid, "io", buf, sizeof(buf)) < 0) return ;
+
+    char *p ;
+    if((p = strstr(buf, "rchar:"))) u -> rchar = strtoull(p + 6, NULL, 10) ;
+    if((p = strstr(buf, "wchar:"))) u -> wchar = strtoull(p + 6, NULL, 10) ;
+}
+
+static void add_process(job *j, pid_t pid, double cpu) {
+    char buf[256] ;
+    long pages ;
+    job_usage u = { cpu, 0, 0, 0 } ;
+
+    if(read_proc(pid, "statm", buf, sizeof(buf)) > 0 && sscanf(buf, "%*d %ld", &pages) == 1) {
+        u.rss_kb = pages * page_kb ;
+    }
+    jobstat_read_io(pid, &u) ;
+
+    j -> live.cpu += u.cpu ;
+    j -> live.rss_kb += u.rss_kb ;
+    j -> live.rchar += u.rchar ;
+    j -> live.wchar += u.wchar ;
+}
+
+void jobstat_exited(job_proc *p, const struct rusage *ru) {
+    p -> use.cpu = timing_tv_sec(ru -> ru_utime) + timing_tv_sec(ru -> ru_stime) ;
+    p -> use.rss_kb = ru -> ru_maxrss ;
+}
+
+// Refreshes live for every unfinished job. Jobs with a group of their own
+// are found in one pass over /proc, so a grandchild such as a compiler under
+// make counts towards its job as well.
+void jobstat_sample(shell_state *st) {
+    int groups = 0 ;
+    double cpu ;
+
+    for(int i = 0 ; i < st -> jobs.n ; i++) {
+        job *j = st -> jobs.list[i] ;
+        if(j -> state == JOB_DONE) continue ;
+
+        memset(&j -> live, 0, sizeof(j -> live)) ;
+        if(j -> pgid > 0) {
+            groups = 1 ;
+            continue ;
+        }
+        for(int k = 0 ; k < j -> n_procs ; k++) {
+            pid_t pid = j -> procs[k].pid ;
+            if(!j -> procs[k].exited && read_stat(pid, &cpu) >= 0) add_process(j, pid, cpu) ;
+        }
+    }
+    if(!groups) return ;
+
+    DIR *d = opendir("/proc") ;
+    if(!d) {
+        perror("/proc") ;
+        return ;
+    }
+    struct dirent *e ;
+    while((e = readdir(d))) {
+        if(!isdigit((unsigned char) e -> d_name[0])) continue ;
+
+        pid_t pid = atoi(e -> d_name) ;
+        pid_t pgrp = read_stat(pid, &cpu) ;
+        job *j = pgrp > 0 ? jobs_by_pgid(st, pgrp) : NULL ;
+        if(j && j -> state != JOB_DONE) add_process(j, pid, cpu) ;
+    }
+    closedir(d) ;
+}
+
+// The live sample plus every exited member; a finished job reports the
+// largest peak RSS of its members instead of what is resident. A process
+// orphaned inside the group is never reaped by a member, so a finished job
+// also never reports less than its last sample showed.
+void jobstat_total(const job *j, job_usage *u) {
+    int done = j -> state == JOB_DONE ;
+
+    if(done) memset(u, 0, sizeof(*u)) ;
+    else *u = j -> live ;
+
+    for(int i = 0 ; i < j -> n_procs ; i++) {
+        const job_proc *p = &j -> procs[i] ;
+        if(!p -> exited) continue ;
+
+        u -> cpu += p -> use.cpu ;
+        u -> rchar += p -> use.rchar ;
+        u -> wchar += p -> use.wchar ;
+        if(done && p -> use.rss_kb > u -> rss_kb) u -> rss_kb = p -> use.rss_kb ;
+    }
+    if(done) {
+        if(j -> live.cpu > u -> cpu) u -> cpu = j -> live.cpu ;
+        if(j -> live.rchar > u -> rchar) u -> rchar = j -> live.rchar ;
+        if(j -> live.wchar > u -> wchar) u -> wchar = j -> live.wchar ;
+    }
+}
+
+const char *jobstat_size(char *buf, size_t n, unsigned long long bytes) {
+    static const char units[] = "BKMGT" ;
+    double v = bytes ;
+    int u = 0 ;
+
+    while(v >= 1024 && u < 4) {
+        v /= 1024 ;
+        u++ ;
+    }
+    if(u == 0) snprintf(buf, n, "%lluB", bytes) ;
+    else snprintf(buf, n, "%.1f%c", v, units[u]) ;
+    return buf ;
+}
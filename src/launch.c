@@ -0,0 +1,182 @@
+#include "../include/posix_lib.h"
+#include "../include/launch.h"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+
+extern char **environ;
+
+// The shell catches SIGINT/SIGTSTP and ignores the rest; children must start
+// with default dispositions or an exec'd program inherits the ignores.
+static const int default_sigs[] = { SIGINT, SIGTSTP, SIGQUIT, SIGTTOU, SIGTTIN };
+#define N_DEFAULT_SIGS (int)(sizeof(default_sigs) / sizeof(default_sigs[0]))
+
+// A child that cannot be held to its limits must not run without them.
+static void apply_limits(const launch_limits *ll) {
+    if(ll -> cgroup_fd >= 0 && write(ll -> cgroup_fd, "0", 1) != 1) {
+        perror("limit: cgroup.procs") ;
+        _exit(126) ;
+    }
+    for(int i = 0 ; i < ll -> n_rlimits ; i++) {
+        if(setrlimit(ll -> resource[i], &ll -> rlim[i]) < 0) {
+            perror("limit: setrlimit") ;
+            _exit(126) ;
+        }
+    }
+}
+
+static void child_setup(const launch_spec *ls) {
+
+    if(ls -> limits) apply_limits(ls -> limits) ;
+    if(ls -> pg_lead > 0) setpgid(0, ls -> pg_lead) ;
+    else setpgid(0, 0) ;
+
+    for(int i = 0 ; i < N_DEFAULT_SIGS ; i++) signal(default_sigs[i], SIG_DFL) ;
+
+    // the interactive shell blocks SIGCHLD for its signalfd
+    sigset_t none ;
+    sigemptyset(&none) ;
+    sigprocmask(SIG_SETMASK, &none, NULL) ;
+
+    int cur_in = -1 ;
+    for(int i = 0 ; i < ls -> n_in ; i++) {
+        int fd = open(ls -> infiles[i], O_RDONLY) ;
+        if(cur_in >= 0) close(cur_in) ;
+        if(fd < 0) {
+            perror(ls -> infiles[i]) ;
+            exit(1) ;
+        }
+        cur_in = fd ;
+    }
+    if(cur_in >= 0) {
+        dup2(cur_in, STDIN_FILENO) ;
+        close(cur_in) ;
+    }
+    else if(ls -> in_fd != STDIN_FILENO) {
+        dup2(ls -> in_fd, STDIN_FILENO) ;
+        if(ls -> bg_detach_stdin) close(ls -> in_fd) ;
+    }
+    else if(!ls -> wait_fg && ls -> bg_detach_stdin) {
+        int devnull = open("/dev/null", O_RDONLY) ;
+        if(devnull >= 0) {
+            dup2(devnull, STDIN_FILENO) ;
+            close(devnull) ;
+        }
+    }
+
+    int cur_out = -1 ;
+    for(int i = 0 ; i < ls -> n_out ; i++) {
+        int fd = open(ls -> outfiles[i], O_WRONLY | O_CREAT | (ls -> append[i] ? O_APPEND : O_TRUNC), 0666) ;
+        if(fd < 0) {
+            printf("Unable to create file for writing\n");
+            _exit(1);
+        }
+        if(cur_out >= 0) close(cur_out) ;
+        cur_out = fd ;
+    }
+    if(cur_out >= 0) {
+        dup2(cur_out, STDOUT_FILENO) ;
+        close(cur_out) ;
+    }
+    else if(ls -> out_fd != STDOUT_FILENO) {
+        dup2(ls -> out_fd, STDOUT_FILENO) ;
+        close(ls -> out_fd) ;
+    }
+}
+
+pid_t launch_fork(const launch_spec *ls) {
+    fflush(stdout) ;
+    pid_t pid = fork() ;
+
+    if(pid == 0) {
+        child_setup(ls) ;
+        if(ls -> builtin) {
+            int ret = ls -> builtin(ls -> builtin_idx, ls -> argv) ;
+            fflush(stdout) ;
+            _exit(ret) ;
+        }
+        // a stale hashed path falls back to a fresh $PATH search
+        if(ls -> path) execv(ls -> path, ls -> argv);
+        execvp(ls -> argv[0], ls -> argv);
+        fprintf(stderr, "Command not found!\n");
+        _exit(127);
+    }
+    return pid ;
+}
+
+// Same fd and process-group layout as child_setup(), expressed as spawn file
+// actions so glibc can launch with CLONE_VM|CLONE_VFORK instead of copying
+// the shell's page tables.
+pid_t launch_spawn(const launch_spec *ls) {
+    posix_spawn_file_actions_t fa ;
+    posix_spawnattr_t attr ;
+    sigset_t defs, none ;
+    pid_t pid = -1 ;
+
+    if(posix_spawn_file_actions_init(&fa)) return -1 ;
+    if(posix_spawnattr_init(&attr)) {
+        posix_spawn_file_actions_destroy(&fa) ;
+        return -1 ;
+    }
+
+    for(int i = 0 ; i < ls -> n_in ; i++) {
+        posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, ls -> infiles[i], O_RDONLY, 0) ;
+    }
+    if(ls -> n_in == 0) {
+        if(ls -> in_fd != STDIN_FILENO) {
+            posix_spawn_file_actions_adddup2(&fa, ls -> in_fd, STDIN_FILENO) ;
+            if(ls -> bg_detach_stdin) posix_spawn_file_actions_addclose(&fa, ls -> in_fd) ;
+        }
+        else if(!ls -> wait_fg && ls -> bg_detach_stdin) {
+            posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0) ;
+        }
+    }
+
+    for(int i = 0 ; i < ls -> n_out ; i++) {
+        posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, ls -> outfiles[i],
+            O_WRONLY | O_CREAT | (ls -> append[i] ? O_APPEND : O_TRUNC), 0666) ;
+    }
+    if(ls -> n_out == 0 && ls -> out_fd != STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&fa, ls -> out_fd, STDOUT_FILENO) ;
+        posix_spawn_file_actions_addclose(&fa, ls -> out_fd) ;
+    }
+
+    sigemptyset(&defs) ;
+    for(int i = 0 ; i < N_DEFAULT_SIGS ; i++) sigaddset(&defs, default_sigs[i]) ;
+    sigemptyset(&none) ;
+
+    posix_spawnattr_setpgroup(&attr, ls -> pg_lead > 0 ? ls -> pg_lead : 0) ;
+    posix_spawnattr_setsigdefault(&attr, &defs) ;
+    posix_spawnattr_setsigmask(&attr, &none) ;
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK) ;
+
+    int rc = ls -> path ?
+        posix_spawn(&pid, ls -> path, &fa, &attr, ls -> argv, environ) :
+        posix_spawnp(&pid, ls -> argv[0], &fa, &attr, ls -> argv, environ) ;
+    if(rc != 0) pid = -1 ;
+    posix_spawnattr_destroy(&attr) ;
+    posix_spawn_file_actions_destroy(&fa) ;
+    return pid ;
+}
+
+static int spawn_enabled(void) {
+    const char *mode = getenv("PSH_SPAWN") ;
+    return !(mode && !strcmp(mode, "fork")) ;
+}
+
+// posix_spawn reports open/exec failures as a bare errno; rerun those through
+// fork() so the child prints the same diagnostics the fork path always has.
+// Builtin stages have nothing to exec and always take the fork path, and so
+// do limited stages, which must join their cgroup before the exec.
+pid_t launch_process(const launch_spec *ls) {
+    if(!ls -> builtin && !ls -> limits && spawn_enabled()) {
+        pid_t pid = launch_spawn(ls) ;
+        if(pid > 0) return pid ;
+    }
+    return launch_fork(ls) ;
+}
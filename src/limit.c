@@ -0,0 +1,334 @@
+#include "../include/posix_lib.h"
+#include "../include/limit.h"
+#include "../include/helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+// `limit mem=SIZE cpu=PCT% pids=N -- pipeline`
+//
+// Each limited pipeline gets a child cgroup of the shell's own cgroup v2
+// group, created when the pipeline starts and removed when its job is gone.
+// Every stage writes itself into the cgroup before exec, so the whole
+// process group and anything it forks is held to memory.max, cpu.max and
+// pids.max. Without a delegated subtree that offers the controllers, the
+// stages get rlimits instead: RLIMIT_AS for mem and RLIMIT_NPROC for pids,
+// which counts every process of the user; cpu has no rlimit counterpart.
+
+#define CPU_PERIOD_US 100000
+
+struct limit_group {
+    char path[PATH_MAX] ;   // "" when falling back to rlimits
+    launch_limits ll ;
+} ;
+
+typedef struct {
+    long long mem ;         // bytes, 0 = unset
+    long cpu ;              // percent of one CPU
+    long pids ;
+} limit_values ;
+
+static char base[PATH_MAX - 32] ;    // room for the child's name
+static int base_state = 0 ;     // 0 unknown, 1 usable, -1 not delegated
+static unsigned seq = 0 ;
+static char leaf[PATH_MAX] ;    // the shell's group once it has left base
+static pid_t leaf_pid = 0 ;
+static const char *enabled[3] ; // controllers the shell switched on in base
+static int n_enabled = 0 ;
+
+static int write_file(const char *dir, const char *file, const char *val) {
+    char path[PATH_MAX] ;
+    snprintf(path, sizeof(path), "%s/%s", dir, file) ;
+
+    int fd = open(path, O_WRONLY | O_CLOEXEC) ;
+    if(fd < 0) return -1 ;
+    ssize_t n = write(fd, val, strlen(val)) ;
+    int err = errno ;
+    close(fd) ;
+    errno = err ;
+    return n == (ssize_t) strlen(val) ? 0 : -1 ;
+}
+
+static int read_file(const char *dir, const char *file, char *buf, size_t n) {
+    char path[PATH_MAX] ;
+    snprintf(path, sizeof(path), "%s/%s", dir, file) ;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC) ;
+    if(fd < 0) return -1 ;
+    ssize_t got = read(fd, buf, n - 1) ;
+    close(fd) ;
+    if(got < 0) return -1 ;
+    buf[got] = '\0' ;
+    return 0 ;
+}
+
+// The cgroup2 mount point from mountinfo, whose fields after the " - "
+// separator are the filesystem type and source.
+static int find_mount(char *mnt, size_t n) {
+    FILE *f = fopen("/proc/self/mountinfo", "r") ;
+    if(!f) return -1 ;
+
+    char line[4096] ;
+    int found = -1 ;
+    while(found < 0 && fgets(line, sizeof(line), f)) {
+        char *sep = strstr(line, " - cgroup2 ") ;
+        char point[PATH_MAX] ;
+        if(sep && sscanf(line, "%*s %*s %*s %*s %4095s", point) == 1) {
+            snprintf(mnt, n, "%s", point) ;
+            found = 0 ;
+        }
+    }
+    fclose(f) ;
+    return found ;
+}
+
+// The shell's own cgroup is the "0::" line of /proc/self/cgroup.
+static int find_base(void) {
+    char mnt[PATH_MAX], line[PATH_MAX] ;
+    if(find_mount(mnt, sizeof(mnt)) < 0) return -1 ;
+
+    FILE *f = fopen("/proc/self/cgroup", "r") ;
+    if(!f) return -1 ;
+    int found = -1 ;
+    while(found < 0 && fgets(line, sizeof(line), f)) {
+        if(strncmp(line, "0::", 3)) continue ;
+        line[strcspn(line, "\n")] = '\0' ;
+        const char *rel = strcmp(line + 3, "/") ? line + 3 : "" ;
+        if(snprintf(base, sizeof(base), "%s%s", mnt, rel) < (int) sizeof(base)) found = 0 ;
+        break ;
+    }
+    fclose(f) ;
+    return found ;
+}
+
+static int has_word(const char *list, const char *w) {
+    size_t n = strlen(w) ;
+    for(const char *p = strstr(list, w) ; p ; p = strstr(p + 1, w)) {
+        if((p == list || p[-1] == ' ') && (p[n] == ' ' || p[n] == '\n' || !p[n])) return 1 ;
+    }
+    return 0 ;
+}
+
+// Whether base has a child group other than the shell's leaf.
+static int base_shared(void) {
+    const char *own = strrchr(leaf, '/') + 1 ;
+    struct stat sb ;
+    struct dirent *de ;
+    int shared = 0 ;
+
+    DIR *d = opendir(base) ;
+    if(!d) return 1 ;
+    while(!shared && (de = readdir(d))) {
+        if(!strcmp(de -> d_name, ".") || !strcmp(de -> d_name, "..") || !strcmp(de -> d_name, own)) continue ;
+        shared = fstatat(dirfd(d), de -> d_name, &sb, 0) == 0 && S_ISDIR(sb.st_mode) ;
+    }
+    closedir(d) ;
+    return shared ;
+}
+
+// At exit the shell switches off what it switched on, goes back to base and
+// removes its leaf. While other groups under base may still need the
+// controllers, the leaf is left for the next session's sweep_leaves().
+static void return_to_base(void) {
+    char pid[32] ;
+
+    if(getpid() != leaf_pid || base_shared()) return ;
+    for(int i = 0 ; i < n_enabled ; i++) {
+        char op[32] ;
+        snprintf(op, sizeof(op), "-%s", enabled[i]) ;
+        write_file(base, "cgroup.subtree_control", op) ;
+    }
+    snprintf(pid, sizeof(pid), "%d", (int) getpid()) ;
+    if(write_file(base, "cgroup.procs", pid) == 0) rmdir(leaf) ;
+}
+
+// Removes the leaves (psh-PID) and limit groups (psh-PID-N) of sessions
+// that have exited. A group still holding a process cannot be removed, so
+// only the pid check keeps a session that has just made its leaf from
+// losing it.
+static void sweep_leaves(void) {
+    struct dirent *de ;
+
+    DIR *d = opendir(base) ;
+    if(!d) return ;
+    while((de = readdir(d))) {
+        const char *name = de -> d_name ;
+        int pid, end = 0, tail = 0 ;
+        unsigned n ;
+        if(sscanf(name, "psh-%d%n", &pid, &end) != 1) continue ;
+        if(name[end] && (sscanf(name + end, "-%u%n", &n, &tail) != 1 || name[end + tail])) continue ;
+        if(pid == (int) getpid() || kill(pid, 0) == 0 || errno != ESRCH) continue ;
+        unlinkat(dirfd(d), name, AT_REMOVEDIR) ;
+    }
+    closedir(d) ;
+}
+
+// cgroup v2 only lets a group with no processes of its own hand controllers
+// down, so the shell moves itself into a leaf of its delegated group.
+static int leave_base(void) {
+    if(snprintf(leaf, sizeof(leaf), "%s/psh-%d", base, (int) getpid()) >= (int) sizeof(leaf)) return -1 ;
+    sweep_leaves() ;
+    if(mkdir(leaf, 0755) < 0 && errno != EEXIST) return -1 ;
+    if(write_file(leaf, "cgroup.procs", "0") < 0) return -1 ;
+    if(!leaf_pid) atexit(return_to_base) ;
+    leaf_pid = getpid() ;
+    return 0 ;
+}
+
+// A child cgroup only gets the controllers its parent has switched on in
+// cgroup.subtree_control; missing ones are switched on if the subtree is
+// ours to change.
+static int enable_controller(const char *name) {
+    char buf[256], op[32] ;
+    if(read_file(base, "cgroup.subtree_control", buf, sizeof(buf)) < 0) return -1 ;
+    if(has_word(buf, name)) return 0 ;
+
+    snprintf(op, sizeof(op), "+%s", name) ;
+    if(write_file(base, "cgroup.subtree_control", op) < 0 &&
+       (errno != EBUSY || leave_base() < 0 || write_file(base, "cgroup.subtree_control", op) < 0)) return -1 ;
+    if(n_enabled < (int) (sizeof(enabled) / sizeof(enabled[0]))) enabled[n_enabled++] = name ;
+    return 0 ;
+}
+
+static int parse_values(char **specs, int n, limit_values *v) {
+    memset(v, 0, sizeof(*v)) ;
+
+    for(int i = 0 ; i < n ; i++) {
+        char *eq = strchr(specs[i], '=') ;
+        const char *val = eq + 1 ;
+        char *end ;
+        size_t klen = eq - specs[i] ;
+
+        if(klen == 3 && !strncmp(specs[i], "mem", 3)) {
+            v -> mem = parse_size(val) ;
+            if(v -> mem > 0) continue ;
+        }
+        else if(klen == 3 && !strncmp(specs[i], "cpu", 3)) {
+            v -> cpu = strtol(val, &end, 10) ;
+            if(v -> cpu > 0 && (!*end || !strcmp(end, "%"))) continue ;
+        }
+        else if(klen == 4 && !strncmp(specs[i], "pids", 4)) {
+            v -> pids = strtol(val, &end, 10) ;
+            if(v -> pids > 0 && !*end) continue ;
+        }
+        else {
+            fprintf(stderr, "limit: unknown limit %.*s\n", (int) klen, specs[i]) ;
+            return -1 ;
+        }
+        fprintf(stderr, "limit: invalid value %s\n", specs[i]) ;
+        return -1 ;
+    }
+    return 0 ;
+}
+
+static int open_cgroup(limit_group *lg, const limit_values *v) {
+    if(base_state == 0) base_state = find_base() == 0 ? 1 : -1 ;
+    if(base_state < 0) return -1 ;
+
+    if((v -> mem && enable_controller("memory") < 0) ||
+       (v -> cpu && enable_controller("cpu") < 0) ||
+       (v -> pids && enable_controller("pids") < 0)) return -1 ;
+
+    snprintf(lg -> path, sizeof(lg -> path), "%s/psh-%d-%u", base, (int) getpid(), ++seq) ;
+    if(mkdir(lg -> path, 0755) < 0) {
+        lg -> path[0] = '\0' ;
+        return -1 ;
+    }
+
+    char val[64] ;
+    int ok = 1 ;
+    if(v -> mem) {
+        snprintf(val, sizeof(val), "%lld", v -> mem) ;
+        ok &= write_file(lg -> path, "memory.max", val) == 0 ;
+    }
+    if(v -> cpu) {
+        snprintf(val, sizeof(val), "%ld %d", v -> cpu * CPU_PERIOD_US / 100, CPU_PERIOD_US) ;
+        ok &= write_file(lg -> path, "cpu.max", val) == 0 ;
+    }
+    if(v -> pids) {
+        snprintf(val, sizeof(val), "%ld", v -> pids) ;
+        ok &= write_file(lg -> path, "pids.max", val) == 0 ;
+    }
+
+    char procs[PATH_MAX + 16] ;
+    snprintf(procs, sizeof(procs), "%s/cgroup.procs", lg -> path) ;
+    lg -> ll.cgroup_fd = ok ? open(procs, O_WRONLY | O_CLOEXEC) : -1 ;
+    if(lg -> ll.cgroup_fd < 0) {
+        rmdir(lg -> path) ;
+        lg -> path[0] = '\0' ;
+        return -1 ;
+    }
+    return 0 ;
+}
+
+static void add_rlimit(launch_limits *ll, int resource, rlim_t value) {
+    ll -> resource[ll -> n_rlimits] = resource ;
+    ll -> rlim[ll -> n_rlimits].rlim_cur = value ;
+    ll -> rlim[ll -> n_rlimits].rlim_max = value ;
+    ll -> n_rlimits++ ;
+}
+
+// Returns NULL after reporting a bad spec.
+limit_group *limit_open(char **specs, int n) {
+    limit_values v ;
+    if(parse_values(specs, n, &v) < 0) return NULL ;
+
+    limit_group *lg = calloc(1, sizeof(*lg)) ;
+    if(!lg) {
+        perror("calloc") ;
+        return NULL ;
+    }
+    lg -> ll.cgroup_fd = -1 ;
+    if(open_cgroup(lg, &v) == 0) return lg ;
+
+    if(v.mem) add_rlimit(&lg -> ll, RLIMIT_AS, (rlim_t) v.mem) ;
+    if(v.pids) add_rlimit(&lg -> ll, RLIMIT_NPROC, (rlim_t) v.pids) ;
+    if(v.cpu) fprintf(stderr, "limit: cpu needs a delegated cgroup, ignored\n") ;
+    return lg ;
+}
+
+const launch_limits *limit_launch(const limit_group *lg) {
+    return &lg -> ll ;
+}
+
+static long long stat_field(const char *text, const char *key) {
+    size_t n = strlen(key) ;
+    for(const char *p = strstr(text, key) ; p ; p = strstr(p + 1, key)) {
+        if((p == text || p[-1] == '\n') && p[n] == ' ') return atoll(p + n + 1) ;
+    }
+    return 0 ;
+}
+
+// Reports what the limits did to the job, then removes the cgroup. A
+// process the job left behind keeps it busy, so that is killed first.
+void limit_close(limit_group *lg, const char *name) {
+    char buf[1024] ;
+
+    if(lg -> path[0]) {
+        if(read_file(lg -> path, "memory.events", buf, sizeof(buf)) == 0) {
+            long long ooms = stat_field(buf, "oom_kill") ;
+            if(ooms) fprintf(stderr, "limit: %s: %lld process(es) killed for exceeding mem\n", name, ooms) ;
+        }
+        if(read_file(lg -> path, "cpu.stat", buf, sizeof(buf)) == 0) {
+            long long periods = stat_field(buf, "nr_throttled") ;
+            long long usec = stat_field(buf, "throttled_usec") ;
+            if(periods) fprintf(stderr, "limit: %s: throttled in %lld periods for %.2fs\n", name, periods, usec / 1e6) ;
+        }
+        close(lg -> ll.cgroup_fd) ;
+        if(rmdir(lg -> path) < 0 && errno == EBUSY) {
+            write_file(lg -> path, "cgroup.kill", "1") ;
+            struct timespec ms = { 0, 1000000 } ;
+            for(int i = 0 ; i < 100 && rmdir(lg -> path) < 0 && errno == EBUSY ; i++) nanosleep(&ms, NULL) ;
+        }
+    }
+    free(lg) ;
+}
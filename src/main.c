@@ -1,3 +1,4 @@
+#include "../include/posix_lib.h"
 #include "../include/main.h"
 #include "../include/runner.h"
 #include "../include/parser.h"
@@ -7,6 +8,7 @@
 #include "../include/shell.h"
 #include "../include/history.h"
 #include "../include/input.h"
+#include "../include/helpers.h"
 
 
 #include<string.h>
@@ -14,6 +16,8 @@
 #include<stdlib.h>
 #include<unistd.h>
 #include<signal.h>
+#include<fcntl.h>
+#include<limits.h>
 
 shell_state global_shell_state ;
 
@@ -22,64 +26,136 @@ static void kill_all(shell_state *st) {
     pid_t g = signals_get_fg_pgid();
     if (g > 0) kill(-g, SIGKILL);
 
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (st -> jobs[i].active ) {
-            kill(-st -> jobs[i].pgid, SIGKILL);
-        }
+    jobs_kill_all(st);
+}
+
+// Returns 0 if the line did not parse.
+static int run_line(const char *line) {
+    int ok = 1;
+
+    sequence *seq = parse_line(&global_shell_state.line_arena, line);
+    if (!seq) {
+        fprintf(stderr, "Syntax error\n");
+        global_shell_state.last_status = 2;
+        ok = 0;
     }
+    else {
+        run_sequence(seq);
+    }
+    arena_reset(&global_shell_state.line_arena);
+    return ok;
 }
 
 void shell_loop() {
     // printf("Welcome to Psh shell!\n") ;
 
-    char *line = NULL;
-    // size_t cap = 0 ;
-
     for(;;) {
-        jobs_check(&global_shell_state) ;
+        // anything that finished during the last command is reported above
+        // the new prompt; later exits are caught by input_read_line()
+        if (signals_drain_chld()) jobs_check(&global_shell_state) ;
+        history_refresh(&global_shell_state);
         show_prompt(&global_shell_state);
         fflush(stdout) ;
 
-        char *raw = input_read_line(&global_shell_state);
-        if (!raw) {
+        char *line = input_read_line(&global_shell_state);
+        if (!line) {
             printf("logout\n");
             kill_all(&global_shell_state);
             break;
         }
-        if (!line) line = malloc(2048);
-        strncpy(line, raw, 2047);
-        line[2047] = '\0';
-        // ssize_t n = strlen(line);
-
-        jobs_check(&global_shell_state) ;
-        if(line[0] == '\0') continue ;
-
-        history_add_if_needed(&global_shell_state, line) ;
-
-        char norm[2048];
-        norm_and_and(line, norm, sizeof(norm)) ;    
-        
-        if(!parse_shell_cmd(norm)) {
-            fprintf(stderr, "Syntax error\n");
-            continue ;
-        } 
-        run_sequence(norm) ;
-        jobs_check(&global_shell_state) ;
+
+        // a bracketed paste can leave several lines to run, in order, each
+        // its own history entry
+        for (char *next = line; next; ) {
+            char *cmd = next;
+            next = strchr(cmd, '\n');
+            if (next) *next++ = '\0';
+            if (cmd[0] == '\0') continue;
+
+            history_add_if_needed(&global_shell_state, cmd) ;
+            run_line(cmd);
+            if (next && signals_drain_chld()) jobs_check(&global_shell_state);
+        }
+    }
+    arena_release(&global_shell_state.line_arena) ;
+}
+
+// Scripts, -c strings and piped input: no prompt, history or raw mode, and
+// lines come through stdio's buffer rather than a read() per byte. A command
+// that reads stdin while psh itself is reading a script from stdin only
+// sees what psh has not buffered yet. As in sh, a syntax error ends the run.
+static int batch_loop(FILE *in) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+
+    while ((n = getline(&line, &cap, in)) > 0) {
+        if (line[n - 1] == '\n') line[n - 1] = '\0';
+        if (!run_line(line)) break;
+        jobs_check(&global_shell_state);
+    }
+    free(line);
+    arena_release(&global_shell_state.line_arena);
+    jobs_close_limits(&global_shell_state);
+    return global_shell_state.last_status;
+}
+
+// psh -c 'cmd', psh script, or input that is not a terminal.
+static FILE *batch_input(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "-c")) {
+        if (argc < 3) {
+            fprintf(stderr, "psh: -c: option requires an argument\n");
+            exit(2);
+        }
+        FILE *f = fmemopen(argv[2], strlen(argv[2]) + 1, "r");
+        if (!f) {
+            perror("fmemopen");
+            exit(2);
+        }
+        return f;
+    }
+    if (argc > 1) {
+        FILE *f = fopen(argv[1], "r");
+        if (!f) {
+            perror(argv[1]);
+            exit(127);
+        }
+        fcntl(fileno(f), F_SETFD, FD_CLOEXEC);
+        return f;
+    }
+    return isatty(STDIN_FILENO) ? NULL : stdin;
+}
+
+static void load_options(void) {
+    const char *pipe_size = getenv("PSH_PIPE_SIZE");
+    if (pipe_size) {
+        long long n = parse_size(pipe_size);
+        if (n < 0 || n > INT_MAX) fprintf(stderr, "psh: PSH_PIPE_SIZE: invalid size %s\n", pipe_size);
+        else global_shell_state.opts.pipe_size = (long)n;
     }
-    free(line) ;
 }
 
-int main() {
+int main(int argc, char **argv) {
     // printf("Starting Psh shell...\n") ;
-    atexit(input_disable_raw); 
-    init_prompt(&global_shell_state);
+    FILE *batch = batch_input(argc, argv);
 
+    init_prompt(&global_shell_state);
     global_shell_state.prev[0] = '\0';
-    global_shell_state.log_count = 0;
-
+    load_options();
     jobs_init(&global_shell_state);
+
+    if (batch) {
+        // stages stay in psh's own process group, so ^C from the
+        // terminal reaches them along with psh
+        global_shell_state.job_control = 0;
+        return batch_loop(batch);
+    }
+
+    atexit(input_disable_raw); 
+    global_shell_state.job_control = 1;
     signals_init() ;
     history_load(&global_shell_state); 
+    atexit(history_sync);
 
     signal(SIGTTOU, SIG_IGN);
     signal(SIGTTIN, SIG_IGN);
@@ -0,0 +1,347 @@
+#include "../include/posix_lib.h"
+#include "../include/parallel.h"
+#include "../include/shell.h"
+#include "../include/jobs.h"
+#include "../include/parser.h"
+#include "../include/runner.h"
+#include "../include/signals.h"
+#include "../include/helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+extern shell_state global_shell_state ;
+
+// parallel [-j N] [command ...] [::: item ...]
+//
+// Every item becomes one job: the item itself when there is no command,
+// otherwise the command with each {} replaced by the quoted item, or the
+// item appended when there is no {}. Items come after ::: or one per line
+// of stdin. At most N jobs run at once and a slot is refilled as soon as
+// jobs_wait() hands back any of them.
+//
+// A job's stdout and stderr go to unlinked temp files that are copied out
+// in one piece when it exits, so the output of two jobs never interleaves.
+// The status is the number of failed jobs, 101 for more than 100, and 130
+// once ^C has stopped the run.
+
+#define MAX_FAILED 101
+
+typedef struct {
+    pid_t pid ;         // 0 for a free slot
+    int out, err ;
+} worker ;
+
+typedef struct {
+    char **list ;       // items after :::, or read from stdin
+    int n, next ;
+    int from_stdin ;
+    char *buf ;         // stdin read so far; buf[off..len) not handed out
+    size_t off, len, cap ;
+    int eof ;
+} item_source ;
+
+// stdin is read with read(2), not stdio: when the script itself comes from
+// stdin, the shell's FILE holds lines it has yet to run.
+static char *read_item(item_source *src) {
+    for(;;) {
+        char *start = src -> buf + src -> off ;
+        size_t left = src -> len - src -> off ;
+        char *nl = left ? memchr(start, '\n', left) : NULL ;
+
+        if(nl || (src -> eof && left)) {
+            size_t n = nl ? (size_t) (nl - start) : left ;
+            src -> off += nl ? n + 1 : n ;
+            return strndup(start, n) ;
+        }
+        if(src -> eof) return NULL ;
+
+        if(src -> off) {
+            memmove(src -> buf, start, left) ;
+            src -> off = 0 ;
+            src -> len = left ;
+        }
+        if(src -> len == src -> cap) {
+            size_t cap = src -> cap ? src -> cap * 2 : 4096 ;
+            char *buf = realloc(src -> buf, cap) ;
+            if(!buf) {
+                perror("realloc") ;
+                return NULL ;
+            }
+            src -> buf = buf ;
+            src -> cap = cap ;
+        }
+        // a ^C (EINTR) ends the items like end of input does
+        ssize_t got = read(STDIN_FILENO, src -> buf + src -> len, src -> cap - src -> len) ;
+        if(got <= 0) src -> eof = 1 ;
+        else src -> len += got ;
+    }
+}
+
+// Returns a malloc'd item, or NULL when the source is used up.
+static char *next_item(item_source *src) {
+    if(src -> from_stdin) return read_item(src) ;
+    if(src -> next >= src -> n) return NULL ;
+    return strdup(src -> list[src -> next++]) ;
+}
+
+// The command words are joined as written, so a template like
+// 'gzip {} && rm {}' keeps its operators; only the item is quoted.
+static char *build_command(char **tmpl, const char *item) {
+    if(!tmpl || !tmpl[0]) return strdup(item) ;
+
+    size_t quoted = 2 ;
+    for(const char *p = item ; *p ; p++) quoted += *p == '\'' ? 4 : 1 ;
+
+    int subst = 0 ;
+    size_t len = 1 ;
+    for(int i = 0 ; tmpl[i] ; i++) {
+        len += strlen(tmpl[i]) + 1 ;
+        for(const char *p = strstr(tmpl[i], "{}") ; p ; p = strstr(p + 2, "{}")) {
+            len += quoted ;
+            subst = 1 ;
+        }
+    }
+    if(!subst) len += quoted + 1 ;
+
+    char *cmd = malloc(len) ;
+    if(!cmd) return NULL ;
+    char *o = cmd ;
+
+    for(int i = 0 ; tmpl[i] || !subst ; i++) {
+        const char *w = tmpl[i] ? tmpl[i] : "{}" ;
+        if(i) *o++ = ' ' ;
+        while(*w) {
+            if(w[0] != '{' || w[1] != '}') {
+                *o++ = *w++ ;
+                continue ;
+            }
+            *o++ = '\'' ;
+            for(const char *p = item ; *p ; p++) {
+                if(*p == '\'') {
+                    memcpy(o, "'\\''", 4) ;
+                    o += 4 ;
+                }
+                else {
+                    *o++ = *p ;
+                }
+            }
+            *o++ = '\'' ;
+            w += 2 ;
+        }
+        if(!tmpl[i]) break ;
+    }
+    *o = '\0' ;
+    return cmd ;
+}
+
+static int temp_file(void) {
+    const char *dir = getenv("TMPDIR") ;
+    char path[4096] ;
+
+    snprintf(path, sizeof(path), "%s/psh-parallel-XXXXXX", dir && *dir ? dir : "/tmp") ;
+    int fd = mkstemp(path) ;
+    if(fd < 0) {
+        perror("parallel: mkstemp") ;
+        return -1 ;
+    }
+    unlink(path) ;
+    fcntl(fd, F_SETFD, FD_CLOEXEC) ;
+    return fd ;
+}
+
+static void copy_out(int fd, int to) {
+    char buf[65536] ;
+    ssize_t n ;
+
+    lseek(fd, 0, SEEK_SET) ;
+    while((n = read(fd, buf, sizeof(buf))) > 0) {
+        for(ssize_t off = 0 ; off < n ; ) {
+            ssize_t w = write(to, buf + off, n - off) ;
+            if(w < 0 && errno == EINTR) continue ;
+            if(w < 0) return ;
+            off += w ;
+        }
+    }
+}
+
+// The child is a copy of the shell that runs cmd like a typed line, minus
+// job control: its stages stay in its group. With job control that group is
+// its own and psh keeps the terminal, so ^C reaches psh, which passes it on,
+// and ^Z, which cannot suspend a builtin, is ignored.
+static pid_t start_worker(shell_state *st, const char *cmd, worker *w, int jc) {
+    w -> out = temp_file() ;
+    w -> err = w -> out < 0 ? -1 : temp_file() ;
+    if(w -> err < 0) {
+        if(w -> out >= 0) close(w -> out) ;
+        return -1 ;
+    }
+    fflush(stdout) ;
+    fflush(stderr) ;
+    pid_t pid = fork() ;
+
+    if(pid < 0) {
+        perror("parallel: fork") ;
+        close(w -> out) ;
+        close(w -> err) ;
+        return -1 ;
+    }
+    if(pid == 0) {
+        if(jc) setpgid(0, 0) ;
+        signal(SIGINT, SIG_DFL) ;
+        signal(SIGTSTP, SIG_DFL) ;
+        signal(SIGTTOU, SIG_DFL) ;
+        signal(SIGTTIN, SIG_DFL) ;
+        sigset_t none ;
+        sigemptyset(&none) ;
+        sigprocmask(SIG_SETMASK, &none, NULL) ;
+
+        int devnull = open("/dev/null", O_RDONLY) ;
+        if(devnull >= 0) {
+            dup2(devnull, STDIN_FILENO) ;
+            close(devnull) ;
+        }
+        dup2(w -> out, STDOUT_FILENO) ;
+        dup2(w -> err, STDERR_FILENO) ;
+        st -> job_control = 0 ;
+
+        sequence *seq = parse_line(&st -> line_arena, cmd) ;
+        if(!seq) {
+            fprintf(stderr, "Syntax error\n") ;
+            _exit(2) ;
+        }
+        int status = run_sequence(seq) ;
+        fflush(stdout) ;
+        _exit(status) ;
+    }
+    if(jc) setpgid(pid, pid) ;
+    w -> pid = pid ;
+    jobs_add(st, jc ? pid : 0, &pid, 1, cmd, JOB_RUNNING) ;
+    return pid ;
+}
+
+static void finish_worker(worker *w) {
+    fflush(stdout) ;
+    fflush(stderr) ;
+    copy_out(w -> out, STDOUT_FILENO) ;
+    copy_out(w -> err, STDERR_FILENO) ;
+    close(w -> out) ;
+    close(w -> err) ;
+    w -> pid = 0 ;
+}
+
+static worker *find_worker(worker *ws, int n, pid_t pid) {
+    for(int i = 0 ; i < n ; i++) {
+        if(ws[i].pid == pid) return &ws[i] ;
+    }
+    return NULL ;
+}
+
+static void interrupt_workers(shell_state *st, worker *ws, int n) {
+    for(int i = 0 ; i < n ; i++) {
+        job *j = ws[i].pid ? jobs_by_pid(st, ws[i].pid) : NULL ;
+        if(j) jobs_signal(j, SIGINT) ;
+    }
+}
+
+static int parse_jobs(const char *s) {
+    char *end ;
+    long n = s ? strtol(s, &end, 10) : 0 ;
+    if(!s || !*s || *end || n < 1 || n > 4096) return -1 ;
+    return (int) n ;
+}
+
+int command_parallel(char **args) {
+    shell_state *st = &global_shell_state ;
+    int i = 1 ;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN) ;
+    int n = cpus > 0 ? (int) cpus : 1 ;
+    if(args[i] && !strncmp(args[i], "-j", 2)) {
+        n = parse_jobs(args[i][2] ? args[i] + 2 : args[++i]) ;
+        if(n < 0) {
+            fprintf(stderr, "parallel: usage: parallel [-j N] [command ...] [::: item ...]\n") ;
+            return 2 ;
+        }
+        i++ ;
+    }
+
+    char **tmpl = &args[i] ;
+    item_source src = { NULL, 0, 0, 1, NULL, 0, 0, 0, 0 } ;
+    for( ; args[i] ; i++) {
+        if(strcmp(args[i], ":::")) continue ;
+        args[i] = NULL ;
+        src.list = &args[i + 1] ;
+        for(src.n = 0 ; src.list[src.n] ; src.n++) {}
+        src.from_stdin = 0 ;
+        break ;
+    }
+
+    int jc = st -> job_control ;
+    worker *ws = calloc(n, sizeof(worker)) ;
+    if(!ws) {
+        perror("calloc") ;
+        return 1 ;
+    }
+    signals_take_interrupt() ;
+
+    int live = 0, total = 0, failed = 0, stop = 0, interrupted = 0 ;
+    char *item ;
+
+    for(;;) {
+        if(signals_take_interrupt()) {
+            interrupt_workers(st, ws, n) ;
+            stop = interrupted = 1 ;
+        }
+        while(!stop && live < n && (item = next_item(&src))) {
+            char *cmd = build_command(tmpl, item) ;
+            free(item) ;
+            worker *w = find_worker(ws, n, 0) ;
+            pid_t pid = cmd ? start_worker(st, cmd, w, jc) : -1 ;
+            free(cmd) ;
+            if(pid < 0) {
+                total++ ;
+                failed++ ;
+                stop = 1 ;
+                break ;
+            }
+            live++ ;
+        }
+        if(!live) break ;
+
+        int status ;
+        job *j ;
+        pid_t pid = jobs_wait(st, -1, &status, 0, &j) ;
+        if(pid < 0) {
+            if(errno == EINTR) continue ;
+            break ;
+        }
+
+        worker *w = find_worker(ws, n, pid) ;
+        if(!w) {
+            if(j && j -> n_live == 0) jobs_finish(st, j) ;
+            continue ;
+        }
+        if(j) jobs_remove(st, j) ;
+        finish_worker(w) ;
+        live-- ;
+        total++ ;
+        if(wait_status_code(status) != 0) failed++ ;
+        if(WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) stop = interrupted = 1 ;
+    }
+    free(ws) ;
+    free(src.buf) ;
+
+    if(interrupted) {
+        if(jc) write(STDOUT_FILENO, "\n", 1) ;
+        return 130 ;
+    }
+    if(failed) fprintf(stderr, "parallel: %d of %d jobs failed\n", failed, total) ;
+    return failed < MAX_FAILED ? failed : MAX_FAILED ;
+}
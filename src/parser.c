@@ -1,110 +1,316 @@
 #include <ctype.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdbool.h>
 
 #include "../include/parser.h"
+#include "../include/arena.h"
 
-static void skip_ws(const char *s, size_t *i) {
-    for ( ; s[*i] && (s[*i] == ' ' || s[*i] == '\t' || s[*i] == '\n') ; (*i)++) {}
-}
+// Grammar:
+//
+//   line     := and_or ( (';' | '&') and_or )* [ ';' | '&' ]
+//   and_or   := pipeline ( ( '&&' | '||' ) pipeline )*
+//   pipeline := [ 'time' [ '-j' ] ] [ limit ] command ( '|' command )*
+//   limit    := 'limit' ( NAME '=' VALUE )+ [ '--' ]
+//   command  := ( WORD | redir )+        with at least one WORD
+//   redir    := ( '<' | '>' | '>>' ) WORD
+//
+// The lexer makes the only pass over the characters. It removes quotes and
+// backslashes while copying each word once into one buffer, and marks the
+// '$' of every expansion so the executor can expand at run time.
+//
+// Everything, including the AST, lives in the caller's arena. Each token
+// covers at least one source byte and adds at most one AST element, so a line
+// of len bytes needs at most 128 * (len + 1) bytes before $VAR expansion. The
+// worst case is a run of one-letter commands like "a;a;a"; bench/parse_bench
+// reports the measured figure.
 
-static bool word(const char *s, size_t *i) {
-    skip_ws(s, i);
-    size_t j = *i;
+typedef enum {
+    TOK_WORD, TOK_PIPE, TOK_AND_IF, TOK_OR_IF, TOK_SEMI, TOK_AMP,
+    TOK_LESS, TOK_GREAT, TOK_DGREAT, TOK_EOF
+} token_type;
 
-    if (!s[j]) return false;
+typedef struct {
+    char *text;
+    unsigned start, end;
+    token_type type;
+    bool expand;
+} token;
 
-    for ( ; s[j] && !isspace((unsigned char)s[j]) && (unsigned char)s[j] != '|' && (unsigned char)s[j] != '&'
-    && (unsigned char)s[j] != '>' && (unsigned char)s[j] != '<' && (unsigned char)s[j] != ';' ; j++) {}
+typedef struct {
+    const char *src;
+    token *toks;
+    int pos;
+    arena *a;
+} parser;
 
-    if (j == *i) return false;
-    *i = j;
-    return true;
+static bool is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
 }
 
-static bool input_redir(const char *s, size_t *i) {
-    size_t save = *i;
-    skip_ws(s, i);
-    if (s[*i] != '<') { *i = save; return false; }
-    (*i)++;
-    if (!word(s, i)) {
-        *i = save; return false;
+// Each token consumes at least one byte, and a cooked word is never longer
+// than its source plus a NUL, so toks needs len + 1 slots and out 2 * len + 1.
+static int lex(const char *s, token *toks, char *out) {
+    int n = 0;
+    unsigned i = 0;
+
+    for (;;) {
+        for ( ; s[i] == ' ' || s[i] == '\t' || s[i] == '\n' ; i++) {}
+
+        token *t = &toks[n++];
+        t -> text = NULL;
+        t -> expand = false;
+        t -> start = i;
+
+        switch (s[i]) {
+            case '\0': t -> type = TOK_EOF; t -> end = i; return n;
+            case '|':
+                if (s[i + 1] == '|') { t -> type = TOK_OR_IF; i += 2; }
+                else { t -> type = TOK_PIPE; i++; }
+                break;
+            case ';':  t -> type = TOK_SEMI; i++; break;
+            case '<':  t -> type = TOK_LESS; i++; break;
+            case '&':
+                if (s[i + 1] == '&') { t -> type = TOK_AND_IF; i += 2; }
+                else { t -> type = TOK_AMP; i++; }
+                break;
+            case '>':
+                if (s[i + 1] == '>') { t -> type = TOK_DGREAT; i += 2; }
+                else { t -> type = TOK_GREAT; i++; }
+                break;
+            default:
+                t -> type = TOK_WORD;
+        }
+        if (t -> type != TOK_WORD) {
+            t -> end = i;
+            continue;
+        }
+
+        t -> text = out;
+        char quote = 0;
+        for (;;) {
+            char c = s[i];
+
+            if (c == '\0') {
+                if (quote) return -1;
+                break;
+            }
+            if (quote == '\'') {
+                if (c != '\'') *out++ = c;
+                else quote = 0;
+                i++;
+                continue;
+            }
+            if (quote == '"') {
+                if (c == '"') { quote = 0; i++; continue; }
+                if (c == '\\' && s[i + 1] && strchr("\"\\$", s[i + 1])) {
+                    *out++ = s[i + 1];
+                    i += 2;
+                    continue;
+                }
+            }
+            else {
+                if (strchr(" \t\n|&;<>", c)) break;
+                if (c == '\'' || c == '"') { quote = c; i++; continue; }
+                if (c == '\\' && s[i + 1]) {
+                    *out++ = s[i + 1];
+                    i += 2;
+                    continue;
+                }
+            }
+            if (c == '$' && (is_name_char(s[i + 1]) || s[i + 1] == '?')) {
+                *out++ = quote ? VAR_MARK_Q : VAR_MARK;
+                t -> expand = true;
+            }
+            else if (c != VAR_MARK && c != VAR_MARK_Q) {
+                *out++ = c;
+            }
+            i++;
+        }
+        *out++ = '\0';
+        t -> end = i;
     }
-    return true;
 }
 
-static bool output_redir(const char *s, size_t *i) {
-    size_t save = *i;
-    skip_ws(s, i);
-    if (s[*i] != '>') { *i = save; return false; }
-    if (s[*i + 1] == '>') (*i) += 2;
-    else (*i)++;
-    if (!word(s, i)) {
-        *i = save; return false;
-    }
-    return true;
+static token *peek(parser *p) {
+    return &p -> toks[p -> pos];
+}
+
+static bool is_redir(token_type t) {
+    return t == TOK_LESS || t == TOK_GREAT || t == TOK_DGREAT;
 }
 
-static bool atomic(const char *s, size_t *i) {
-    skip_ws(s, i);
-    if (!word(s, i)) return false;
+// Makes arr[n] a valid slot.
+static void *grow(parser *p, void *arr, int n, int *cap, size_t elem) {
+    if (n < *cap) return arr;
+
+    int ncap = *cap ? *cap : 1;
+    while (ncap <= n) ncap *= 2;
+    arr = arena_realloc(p -> a, arr, *cap * elem, ncap * elem);
+    *cap = ncap;
+    return arr;
+}
+
+static bool parse_command(parser *p, simple_cmd *c) {
+    int argv_cap = 0, redir_cap = 0;
 
     for (;;) {
-        size_t save = *i;
-        skip_ws(s, i);
-        if (input_redir(s, i) || output_redir(s, i) || word(s, i)) {
-            continue;
+        token *t = peek(p);
+
+        if (t -> type == TOK_WORD) {
+            // room for this word and the NULL after it
+            c -> argv = grow(p, c -> argv, c -> argc + 1, &argv_cap, sizeof(char *));
+            c -> argv[c -> argc++] = t -> text;
+            c -> expand |= t -> expand;
+            p -> pos++;
+        }
+        else if (is_redir(t -> type)) {
+            token *w = &p -> toks[p -> pos + 1];
+            if (w -> type != TOK_WORD) return false;
+            c -> redirs = grow(p, c -> redirs, c -> n_redirs, &redir_cap, sizeof(redir));
+
+            redir *r = &c -> redirs[c -> n_redirs++];
+            r -> type = t -> type == TOK_LESS ? REDIR_IN :
+                        t -> type == TOK_DGREAT ? REDIR_APPEND : REDIR_OUT;
+            r -> target = w -> text;
+            c -> expand |= w -> expand;
+            p -> pos += 2;
+        }
+        else {
+            break;
         }
-        *i = save;
-        break;
     }
+    if (c -> argc == 0) return false;
+    c -> argv[c -> argc] = NULL;
     return true;
 }
 
-static bool valid_cmd_seg(const char *s, size_t *i) {
-    skip_ws(s, i);
+// `time` is a keyword only when written bare at the start of a pipeline that
+// has a command after it; `"time"` or a lone `time` stays an ordinary word.
+static bool is_keyword(parser *p, token *t, const char *kw) {
+    size_t n = strlen(kw);
+    return t -> type == TOK_WORD && t -> end - t -> start == n &&
+           !strncmp(p -> src + t -> start, kw, n);
+}
+
+static void parse_time_prefix(parser *p, pipeline *pl) {
+    if (!is_keyword(p, peek(p), "time")) return;
+
+    int skip = 1;
+    time_mode mode = TIME_TEXT;
+    if (is_keyword(p, &p -> toks[p -> pos + 1], "-j")) {
+        skip = 2;
+        mode = TIME_JSON;
+    }
+    token *next = &p -> toks[p -> pos + skip];
+    if (next -> type != TOK_WORD && !is_redir(next -> type)) return;
+
+    pl -> timed = mode;
+    p -> pos += skip;
+}
+
+static bool is_assignment(const char *w) {
+    const char *s = w;
+    while (is_name_char(*s)) s++;
+    return s > w && *s == '=';
+}
+
+// Likewise `limit` needs at least one NAME=VALUE after it and a command
+// after those, optionally behind `--`.
+static void parse_limit_prefix(parser *p, pipeline *pl) {
+    if (!is_keyword(p, peek(p), "limit")) return;
+
+    int first = p -> pos + 1, i = first;
+    while (p -> toks[i].type == TOK_WORD && is_assignment(p -> toks[i].text)) i++;
+    int n = i - first;
+    if (n == 0) return;
+
+    if (is_keyword(p, &p -> toks[i], "--")) i++;
+    token *next = &p -> toks[i];
+    if (next -> type != TOK_WORD && !is_redir(next -> type)) return;
+
+    pl -> limits = arena_alloc(p -> a, n * sizeof(char *));
+    for (int k = 0; k < n; k++) pl -> limits[k] = p -> toks[first + k].text;
+    pl -> n_limits = n;
+    p -> pos = i;
+}
 
-    if (!atomic(s, i)) return false;
+static bool parse_pipeline(parser *p, pipeline *pl) {
+    int cap = 0;
+
+    parse_time_prefix(p, pl);
+    parse_limit_prefix(p, pl);
+    unsigned start = peek(p) -> start;
 
     for (;;) {
-        size_t save = *i;
-        skip_ws(s, i);
+        pl -> cmds = grow(p, pl -> cmds, pl -> n_cmds, &cap, sizeof(simple_cmd));
 
-        if (s[*i] != '|') {
-            *i = save;
-            break;
-        }
-        (*i)++; skip_ws(s, i);
-        if (!atomic(s, i)) return false;
+        simple_cmd *c = &pl -> cmds[pl -> n_cmds++];
+        memset(c, 0, sizeof(*c));
+        if (!parse_command(p, c)) return false;
+
+        if (peek(p) -> type != TOK_PIPE) break;
+        p -> pos++;
     }
+
+    unsigned end = p -> toks[p -> pos - 1].end;
+    pl -> text = arena_strndup(p -> a, p -> src + start, end - start);
     return true;
 }
 
-bool parse_shell_cmd(const char *s) {
-    size_t i = 0;
-
-    if (!valid_cmd_seg(s, &i)) return false;
+static bool parse_and_or(parser *p, and_or *ao) {
+    int cap = 0;
+    bool or_if = false;
 
     for (;;) {
-        size_t save = i;
-        skip_ws(s, &i);
+        ao -> pipes = grow(p, ao -> pipes, ao -> n_pipes, &cap, sizeof(pipeline));
 
-        if (s[i] == '&' || s[i] == ';') {
-            i++; skip_ws(s, &i);
+        pipeline *pl = &ao -> pipes[ao -> n_pipes++];
+        memset(pl, 0, sizeof(*pl));
+        pl -> or_if = or_if;
+        if (!parse_pipeline(p, pl)) return false;
 
-            if (!valid_cmd_seg(s, &i)) {
-                i = save;
-                break;
-            }
-        } else {
-            i = save;
-            break;
+        token_type t = peek(p) -> type;
+        if (t != TOK_AND_IF && t != TOK_OR_IF) break;
+        or_if = (t == TOK_OR_IF);
+        p -> pos++;
+    }
+    return true;
+}
+
+static bool parse_list(parser *p, sequence *seq) {
+    int cap = 0;
+
+    while (peek(p) -> type != TOK_EOF) {
+        seq -> items = grow(p, seq -> items, seq -> n_items, &cap, sizeof(and_or));
+
+        and_or *ao = &seq -> items[seq -> n_items++];
+        memset(ao, 0, sizeof(*ao));
+        if (!parse_and_or(p, ao)) return false;
+
+        token_type t = peek(p) -> type;
+        if (t == TOK_SEMI || t == TOK_AMP) {
+            ao -> background = (t == TOK_AMP);
+            p -> pos++;
+        }
+        else if (t != TOK_EOF) {
+            return false;
         }
     }
+    return true;
+}
+
+// Returns NULL on a syntax error. A blank line gives an empty sequence.
+sequence *parse_line(arena *a, const char *line) {
+    size_t len = strlen(line);
+
+    token *toks = arena_alloc(a, (len + 1) * sizeof(token));
+    char *words = arena_alloc(a, 2 * len + 1);
+    if (lex(line, toks, words) < 0) return NULL;
 
-    skip_ws(s, &i);
-    if (s[i] == '&' || s[i] == ';') i++;
+    sequence *seq = arena_alloc(a, sizeof(*seq));
+    memset(seq, 0, sizeof(*seq));
 
-    skip_ws(s, &i);
-    return s[i] == '\0';
+    parser p = { line, toks, 0, a };
+    return parse_list(&p, seq) ? seq : NULL;
 }
@@ -33,7 +33,9 @@ void init_prompt(shell_state *st) {
     else st -> home[0] = '\0' ;
 }
 
-void show_prompt(const shell_state *st) {
+// Writes the prompt into out, truncated to n - 1 bytes, and returns the
+// length it would have had.
+size_t prompt_format(const shell_state *st, char *out, size_t n) {
     char host[256] ;
 
     if(gethostname(host, sizeof(host))) {
@@ -47,6 +49,14 @@ void show_prompt(const shell_state *st) {
     }
     char path[PATH_MAX] ;
     path_for_prompt(st, path) ;
-    printf("%s@%s:%s$ ", user, host, path) ;
+    int len = snprintf(out, n, "%s@%s:%s$ ", user, host, path) ;
+    return len < 0 ? 0 : (size_t) len ;
+}
+
+void show_prompt(const shell_state *st) {
+    char prompt[PROMPT_MAX] ;
+
+    prompt_format(st, prompt, sizeof(prompt)) ;
+    fputs(prompt, stdout) ;
     fflush(stdout) ;
-}
\ No newline at end of file
+}
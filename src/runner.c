@@ -1,122 +1,98 @@
-#include "../include/builtins.h"
-#include "../include/helpers.h"
 #include "../include/runner.h"
 #include "../include/execute.h"
+#include "../include/parser.h"
+#include "../include/shell.h"
+#include "../include/jobs.h"
 
 #include<string.h>
 #include<stdio.h>
 #include<stdlib.h>
 #include<unistd.h>
-#include<sys/wait.h>
+#include<fcntl.h>
+#include<signal.h>
 
+extern shell_state global_shell_state ;
 
-static int split_words(char *line, char **args) {
-    int n = 0; char *tok = strtok(line, " \t");
-    while (tok && n < 64) { args[n++] = tok; tok = strtok(NULL, " \t"); }
-    args[n] = NULL ;
-    return n;
-}
+// Runs the pipelines of one and_or item in the foreground, skipping each one
+// its && or || rules out. A skipped pipeline is never expanded or launched
+// and leaves the status as it was, so `false || true && echo ok` prints ok.
+static int run_and_or(and_or *ao) {
+    int status = 0 ;
 
-void norm_and_and(const char *in, char *out, size_t sz){
+    for(int j = 0 ; j < ao -> n_pipes ; j++) {
+        pipeline *pl = &ao -> pipes[j] ;
 
-    size_t j = 0;
-    for(size_t i = 0; in[i] && j + 1 < sz; i++, j++) {
-        if(in[i] == '&' && in[i + 1] == '&') {
-            out[j] = ';';
-            i++ ;
-        } else {
-            out[j] = in[i];
-        }
+        if(j > 0 && (pl -> or_if ? status == 0 : status != 0)) continue ;
+        status = execute_pipeline(pl, 1, NULL) ;
     }
-    out[j] = '\0';
+    return status ;
 }
 
-int run_sequence(const char *line) {
-    char buf[2048] ;
-    strncpy(buf, line, sizeof(buf) - 1);
-    buf[sizeof(buf) - 1] = '\0';
-    int n = (int)strlen(buf) ;
+// The job name of a background list, rebuilt from its pipelines.
+static char *and_or_text(and_or *ao) {
+    size_t len = 1 ;
+    for(int j = 0 ; j < ao -> n_pipes ; j++) len += strlen(ao -> pipes[j].text) + 4 ;
 
-    char *cmd[128] ;
-    char bg[128] = {0} ;
-    int cnt = 0 , st = 0 ;
+    char *s = arena_alloc(&global_shell_state.line_arena, len) ;
+    char *p = s ;
+    for(int j = 0 ; j < ao -> n_pipes ; j++) {
+        if(j) p += sprintf(p, ao -> pipes[j].or_if ? " || " : " && ") ;
+        p += sprintf(p, "%s", ao -> pipes[j].text) ;
+    }
+    return s ;
+}
 
-    for(int i = 0 ; i < n; i++) {
-        if(buf[i] == ';' || buf[i] == '&') {
-            bg[cnt] = (buf[i] == '&') ;
-            buf[i] = '\0' ;
-            cmd[cnt++] = buf + st ;
-            st = i + 1 ;
-        }
+// `a && b &` has to evaluate a before deciding on b, so the whole list runs
+// in a forked copy of the shell that plays the part of one background job.
+// The copy has no terminal to hand around: its stages join its own process
+// group and it reaps them by pid.
+static void run_and_or_background(and_or *ao) {
+    fflush(stdout) ;
+    pid_t pid = fork() ;
+
+    if(pid < 0) {
+        perror("fork") ;
+        return ;
     }
-    if(st <= n) {
-        cmd[cnt] = buf + st ;
-        bg[cnt++] = 0 ;
+    if(pid == 0) {
+        setpgid(0, 0) ;
+        signal(SIGINT, SIG_DFL) ;
+        signal(SIGTSTP, SIG_DFL) ;
+        signal(SIGTTOU, SIG_DFL) ;
+        signal(SIGTTIN, SIG_DFL) ;
+
+        int devnull = open("/dev/null", O_RDONLY) ;
+        if(devnull >= 0) {
+            dup2(devnull, STDIN_FILENO) ;
+            close(devnull) ;
+        }
+        global_shell_state.job_control = 0 ;
+        int status = run_and_or(ao) ;
+        fflush(stdout) ;
+        _exit(status) ;
     }
-    for(int i = 0 ; i < cnt; i++) {
-        char temp[1024] ;
-        strncpy(temp, cmd[i], sizeof(temp) - 1) ;
-        temp[sizeof(temp) - 1] = '\0' ;
-
-        if(!temp[0]) continue ;
-        char *s = temp ;
-
-        for(; *s == ' ' || *s == '\t'; s++) {}
-        if(*s == '\0') continue ;
-
-        char name[1024] ;
-        my_strncpy(name, s, sizeof(name) - 1) ;
-        name[sizeof(name) - 1] = '\0' ;
-
-        char *first = strtok(name, " \t|&><;") ;
-        if(!first) continue ;
+    setpgid(pid, pid) ;
+    global_shell_state.last_status = 0 ;
 
-        int hard = !!(strchr(first, '|') || strchr(first, '>') || strchr(first, '<') || strchr(first, ';') );
-
-        const char* built_in_commands[] = {"cd", "pwd", "echo", "env", "setenv", "unsetenv", "which", "exit"} ;
-        // (void) bg ;
-        // printf("Command to run: %s\n", s) ;
-        if(!hard) {
-            int is_builtin = 0 ;   
-
-            for(int j = 0 ; j < 8 ; j++) {       
-                if(!strcmp(first, built_in_commands[j])) {
-
-                is_builtin = 1;
+    job *j = jobs_add(&global_shell_state, pid, &pid, 1, and_or_text(ao), JOB_RUNNING) ;
+    if(global_shell_state.job_control) printf("[%d] %d\n", j -> id, (int) pid) ;
+}
 
-                char temp[1024]; 
-                my_strncpy(temp, s, sizeof(temp) - 1 );
-                temp[sizeof(temp) - 1 ] = '\0'; 
+int run_sequence(sequence *seq) {
 
-                char *args[64]; 
-                int argc = split_words(temp, args);
+    for(int i = 0 ; i < seq -> n_items ; i++) {
+        and_or *ao = &seq -> items[i] ;
 
-                if (argc == 0) continue;
-                // printf("Running built-in command: %s\n", args[0]) ;
-                    switch(j) {
-                        case 0: command_cd(args) ; break ;
-                        case 1: command_pwd() ; break ;
-                        case 2: command_echo(args, NULL) ; break ;
-                        case 3: command_env(NULL) ; break ;
-                        case 4: command_setenv(args) ; break ;
-                        case 5: command_unsetenv(args) ; break ;
-                        case 6: command_which(args, NULL) ; break ;
-                        case 7: exit(0) ; break ;
-                    }
-                    break ;
-                }
-            }
-            if(is_builtin) continue ;
+        if(!ao -> background) {
+            run_and_or(ao) ;
+        }
+        else if(ao -> n_pipes == 1) {
+            execute_pipeline(&ao -> pipes[0], 0, NULL) ;
+            global_shell_state.last_status = 0 ;
+        }
+        else {
+            run_and_or_background(ao) ;
         }
-        // printf("Running command: %s\n", s) ;
-        pid_t pid = -1 ;
-        char execbuf[1024] ;
-        my_strncpy(execbuf, s, sizeof(execbuf) - 1) ;
-        execbuf[sizeof(execbuf) - 1] = '\0' ;
-
-        int wait_fg = !bg[i] ;
-
-        execute_command(execbuf, wait_fg, &pid) ;
     }
-    return 1 ;
-}
\ No newline at end of file
+    return global_shell_state.last_status ;
+}
@@ -1,20 +1,18 @@
 #include "../include/posix_lib.h"
 #include "../include/signals.h"
 #include "../include/shell.h"
-#include "../include/jobs.h"
 
 #include <signal.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
 
 static volatile sig_atomic_t fg_pgid = -1;
+static volatile sig_atomic_t interrupted = 0;
 static char fg_name[256] = {0};
-extern shell_state global_shell_state;
-
-static volatile sig_atomic_t pending_tstp = 0;
-static volatile sig_atomic_t pending_tstp_pgid = -1;
+static int chld_fd = -1;
 
 static void on_sigint(int sig) {
     (void)sig;
@@ -22,6 +20,9 @@ static void on_sigint(int sig) {
     if (pg > 0) {
         kill(-pg, SIGINT); 
     }
+    else {
+        interrupted = 1;    // ^C at the prompt, see input_read_line()
+    }
 }
 
 static void on_sigtstp(int sig) {
@@ -29,8 +30,6 @@ static void on_sigtstp(int sig) {
     pid_t pg = fg_pgid;
     if (pg > 0) {
         kill(-pg, SIGTSTP);          
-        pending_tstp_pgid = pg;      
-        pending_tstp = 1;           
     }
 }
 
@@ -53,6 +52,37 @@ void signals_init() {
     sigaction(SIGTSTP, &sa_tstp, NULL);
 
     signal(SIGQUIT, SIG_IGN);
+
+    // SIGCHLD is only ever read from chld_fd, which the line reader polls
+    // alongside stdin. Children get an empty mask back in launch.c.
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+    chld_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (chld_fd < 0) {
+        perror("signalfd");
+        sigprocmask(SIG_UNBLOCK, &chld, NULL);
+    }
+}
+
+int signals_chld_fd(void) { return chld_fd; }
+
+// Empties the signalfd. Returns 1 if a child changed state since the last
+// call, which is the only time jobs_check() has anything to reap.
+int signals_drain_chld(void) {
+    struct signalfd_siginfo si[16];
+    int got = 0;
+
+    if (chld_fd < 0) return 1;
+    while (read(chld_fd, si, sizeof(si)) > 0) got = 1;
+    return got;
+}
+
+int signals_take_interrupt(void) {
+    int was = interrupted;
+    interrupted = 0;
+    return was;
 }
 
 void signals_set_fg_pgid(pid_t pgid, const char *cmd) {
@@ -71,26 +101,3 @@ void signals_set_fg_pgid(pid_t pgid, const char *cmd) {
 
 pid_t signals_get_fg_pgid(void) { return fg_pgid; }
 const char *signals_get_fg_name(void) { return fg_name; }
-
-void signals_handle_pending(void) {
-    if (!pending_tstp) return;
-
-    pid_t pg = (pid_t) pending_tstp_pgid;
-    pending_tstp = 0;
-    pending_tstp_pgid = -1;
-
-    if (pg > 0) {
-        int id = jobs_add(&global_shell_state, pg, fg_name);
-        if (id > 0) {
-            for (int i = 0; i < MAX_JOBS; i++) {
-                if (global_shell_state.jobs[i].active && global_shell_state.jobs[i].id == id) {
-                    global_shell_state.jobs[i].state = JOB_STOPPED;
-                    global_shell_state.jobs[i].pid = pg;
-                    break;
-                }
-            }
-            printf("[%d] Stopped %s with pid %d\n", id, fg_name, (int) pg);
-            fflush(stdout);
-        }
-    }
-}
@@ -0,0 +1,110 @@
+#include "../include/posix_lib.h"
+#include "../include/timing.h"
+
+#include <stdio.h>
+#include <sys/time.h>
+
+// Reports for the `time` keyword, written to stderr so they never mix with
+// the pipeline's own output.
+
+double timing_tv_sec(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6 ;
+}
+
+double timing_elapsed(const struct timespec *from, const struct timespec *to) {
+    return (to -> tv_sec - from -> tv_sec) + (to -> tv_nsec - from -> tv_nsec) / 1e9 ;
+}
+
+static void tv_sub(struct timeval *a, struct timeval b) {
+    a -> tv_sec -= b.tv_sec ;
+    a -> tv_usec -= b.tv_usec ;
+    if(a -> tv_usec < 0) {
+        a -> tv_sec-- ;
+        a -> tv_usec += 1000000 ;
+    }
+}
+
+// Turns a RUSAGE_SELF sample taken after an in-shell stage into the cost of
+// that stage alone. ru_maxrss is a high-water mark and stays absolute.
+void timing_self_delta(struct rusage *ru, const struct rusage *before) {
+    getrusage(RUSAGE_SELF, ru) ;
+    tv_sub(&ru -> ru_utime, before -> ru_utime) ;
+    tv_sub(&ru -> ru_stime, before -> ru_stime) ;
+    ru -> ru_nvcsw -= before -> ru_nvcsw ;
+    ru -> ru_nivcsw -= before -> ru_nivcsw ;
+    ru -> ru_majflt -= before -> ru_majflt ;
+    ru -> ru_minflt -= before -> ru_minflt ;
+}
+
+static void json_str(const char *s) {
+    fputc('"', stderr) ;
+    for( ; s && *s ; s++) {
+        unsigned char c = *s ;
+        if(c == '"' || c == '\\') fprintf(stderr, "\\%c", c) ;
+        else if(c < 0x20) fprintf(stderr, "\\u%04x", c) ;
+        else fputc(c, stderr) ;
+    }
+    fputc('"', stderr) ;
+}
+
+static void json_usage(double wall, const struct rusage *ru) {
+    fprintf(stderr, "\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+                    "\"nvcsw\":%ld,\"nivcsw\":%ld,\"majflt\":%ld,\"minflt\":%ld",
+            wall, timing_tv_sec(ru -> ru_utime), timing_tv_sec(ru -> ru_stime), ru -> ru_maxrss,
+            ru -> ru_nvcsw, ru -> ru_nivcsw, ru -> ru_majflt, ru -> ru_minflt) ;
+}
+
+static void text_usage(const char *label, double wall, const struct rusage *ru, const char *name) {
+    fprintf(stderr, "%-6s %9.3fs %8.3fs %8.3fs %9ldK %8ld/%-8ld %6ld/%-8ld %s\n",
+            label, wall, timing_tv_sec(ru -> ru_utime), timing_tv_sec(ru -> ru_stime), ru -> ru_maxrss,
+            ru -> ru_nvcsw, ru -> ru_nivcsw, ru -> ru_majflt, ru -> ru_minflt, name) ;
+}
+
+// A stage's wall time runs from the start of the pipeline to its own exit,
+// so the stage that dominates is the one closest to the total. The total
+// sums CPU, switches and faults, and takes the largest max RSS.
+void timing_report(const char *text, const stage_stat *st, int n, const struct timespec *start, int json) {
+    struct rusage total = {0} ;
+    struct timespec now ;
+    clock_gettime(CLOCK_MONOTONIC, &now) ;
+
+    for(int i = 0 ; i < n ; i++) {
+        const struct rusage *ru = &st[i].ru ;
+        total.ru_utime.tv_sec += ru -> ru_utime.tv_sec ;
+        total.ru_utime.tv_usec += ru -> ru_utime.tv_usec ;
+        total.ru_stime.tv_sec += ru -> ru_stime.tv_sec ;
+        total.ru_stime.tv_usec += ru -> ru_stime.tv_usec ;
+        if(ru -> ru_maxrss > total.ru_maxrss) total.ru_maxrss = ru -> ru_maxrss ;
+        total.ru_nvcsw += ru -> ru_nvcsw ;
+        total.ru_nivcsw += ru -> ru_nivcsw ;
+        total.ru_majflt += ru -> ru_majflt ;
+        total.ru_minflt += ru -> ru_minflt ;
+    }
+    double wall = timing_elapsed(start, &now) ;
+
+    if(json) {
+        fprintf(stderr, "{\"pipeline\":") ;
+        json_str(text) ;
+        fprintf(stderr, ",\"stages\":[") ;
+        for(int i = 0 ; i < n ; i++) {
+            fprintf(stderr, "%s{\"cmd\":", i ? "," : "") ;
+            json_str(st[i].name) ;
+            fprintf(stderr, ",\"pid\":%d,\"status\":%d,", (int) st[i].pid, st[i].status) ;
+            json_usage(timing_elapsed(start, &st[i].end), &st[i].ru) ;
+            fputc('}', stderr) ;
+        }
+        fprintf(stderr, "],\"total\":{") ;
+        json_usage(wall, &total) ;
+        fprintf(stderr, "}}\n") ;
+        return ;
+    }
+
+    fprintf(stderr, "%-6s %10s %9s %9s %10s %17s %15s %s\n",
+            "stage", "wall", "user", "sys", "maxrss", "ctxsw vol/invol", "faults maj/min", "command") ;
+    for(int i = 0 ; i < n ; i++) {
+        char label[16] ;
+        snprintf(label, sizeof(label), "%d", i + 1) ;
+        text_usage(label, timing_elapsed(start, &st[i].end), &st[i].ru, st[i].name) ;
+    }
+    text_usage("total", wall, &total, text) ;
+}